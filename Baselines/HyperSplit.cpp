@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "HyperSplit.h"
+
+#include "../Utilities/MapExtensions.h"
+
+#include <limits>
+
+using namespace std;
+
+HyperSplitClassifier::HyperSplitClassifier(const unordered_map<string, string>& args)
+	: binth(GetUIntOrElse(args, "HS.Binth", 8)) {
+}
+
+void HyperSplitClassifier::ConstructClassifier(const vector<Rule>& rules) {
+	this->rules = rules;
+	SortRules(this->rules);
+	numRules = rules.size();
+	height = 0;
+	nodes.clear();
+	leafRules.clear();
+	
+	vector<uint32_t> rl(numRules);
+	iota(rl.begin(), rl.end(), 0);
+	Region region;
+	for (size_t d = 0; d < NumDims; d++) {
+		region[d] = { 0, numeric_limits<Point>::max() };
+	}
+	nodes.push_back(HSNode());
+	Build(0, rl, region, 1);
+}
+
+void HyperSplitClassifier::Build(size_t node, const vector<uint32_t>& rl, const Region& region, int depth) {
+	height = max(height, depth);
+	
+	// Rules are in priority order, so nothing under a rule that covers the whole region can match
+	size_t leafSize = rl.size();
+	for (size_t i = 0; i < rl.size(); i++) {
+		const Rule& r = rules[rl[i]];
+		bool covers = true;
+		for (size_t d = 0; d < NumDims && covers; d++) {
+			covers = r.range[d].low <= region[d].low && r.range[d].high >= region[d].high;
+		}
+		if (covers) {
+			leafSize = i + 1;
+			break;
+		}
+	}
+	
+	uint32_t dim;
+	Point point;
+	if (leafSize <= binth || !ChooseSplit(rl, region, dim, point)) {
+		nodes[node] = { Leaf, 0, (uint32_t)leafRules.size(), (uint32_t)leafSize };
+		for (size_t i = 0; i < leafSize; i++) {
+			leafRules.push_back(rules[rl[i]]);
+		}
+		return;
+	}
+	
+	Region left = region, right = region;
+	left[dim].high = point;
+	right[dim].low = point + 1;
+	vector<uint32_t> leftRules, rightRules;
+	for (uint32_t i : rl) {
+		const Interval& s = rules[i].range[dim];
+		if (s.low <= point) leftRules.push_back(i);
+		if (s.high > point) rightRules.push_back(i);
+	}
+	
+	uint32_t child = nodes.size();
+	nodes[node] = { dim, point, child, 0 };
+	nodes.resize(child + 2);
+	Build(child, leftRules, left, depth + 1);
+	Build(child + 1, rightRules, right, depth + 1);
+}
+
+bool HyperSplitClassifier::ChooseSplit(const vector<uint32_t>& rl, const Region& region, uint32_t& bestDim, Point& bestPoint) const {
+	double bestAverage = numeric_limits<double>::max();
+	for (uint32_t d = 0; d < NumDims; d++) {
+		// Segments are the elementary intervals between rule ends inside the region
+		vector<Point> starts = { region[d].low };
+		for (uint32_t i : rl) {
+			const Interval& s = rules[i].range[d];
+			starts.push_back(max(s.low, region[d].low));
+			if (s.high < region[d].high) {
+				starts.push_back(s.high + 1);
+			}
+		}
+		sort(starts.begin(), starts.end());
+		starts.erase(unique(starts.begin(), starts.end()), starts.end());
+		if (starts.size() < 2) continue;
+		
+		vector<int64_t> weights(starts.size() + 1, 0);
+		for (uint32_t i : rl) {
+			const Interval& s = rules[i].range[d];
+			size_t first = upper_bound(starts.begin(), starts.end(), max(s.low, region[d].low)) - starts.begin() - 1;
+			size_t last = upper_bound(starts.begin(), starts.end(), min(s.high, region[d].high)) - starts.begin();
+			weights[first]++;
+			weights[last]--;
+		}
+		int64_t total = 0;
+		for (size_t k = 0; k < starts.size(); k++) {
+			if (k > 0) weights[k] += weights[k - 1];
+			total += weights[k];
+		}
+		
+		double average = 1.0 * total / starts.size();
+		if (average >= bestAverage) continue;
+		
+		// Split after the segment where the running weight reaches half
+		int64_t running = 0;
+		size_t k = 0;
+		for (; k + 2 < starts.size(); k++) {
+			running += weights[k];
+			if (2 * running >= total) break;
+		}
+		bestAverage = average;
+		bestDim = d;
+		bestPoint = starts[k + 1] - 1;
+	}
+	return bestAverage < numeric_limits<double>::max();
+}
+
+int HyperSplitClassifier::ClassifyAPacket(const Packet& packet) const {
+	const HSNode* n = &nodes[0];
+	while (n->dim != Leaf) {
+		n = &nodes[n->index + (packet[n->dim] > n->point)];
+	}
+	const Rule* r = leafRules.data() + n->index;
+	for (uint32_t i = 0; i < n->count; i++) {
+		if (r[i].MatchesPacket(packet)) {
+			return r[i].priority;
+		}
+	}
+	return -1;
+}
+
+void HyperSplitClassifier::ClassifyPackets(const Packet* packets, size_t n, int* results) const {
+	for (size_t i = 0; i < n; i++) {
+		results[i] = HyperSplitClassifier::ClassifyAPacket(packets[i]);
+	}
+}
+
+Memory HyperSplitClassifier::MemSizeBytes() const {
+	return nodes.size() * sizeof(HSNode) + leafRules.size() * sizeof(Rule);
+}
+
+map<string, string> HyperSplitClassifier::EngineStats() const {
+	size_t leaves = 0;
+	for (const HSNode& n : nodes) {
+		if (n.dim == Leaf) leaves++;
+	}
+	printf("\tNodes: %lu, leaves: %lu, height: %d, leaf rules: %lu\n", nodes.size(), leaves, height, leafRules.size());
+	return {{"Nodes", to_string(nodes.size())}, {"Leaves", to_string(leaves)}, {"MaxHeight", to_string(height)}, {"LeafRules", to_string(leafRules.size())}};
+}
@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef HyperSplit_H
+#define HyperSplit_H
+
+#include "../Common.h"
+
+#include <unordered_map>
+
+// Baseline HyperSplit decision tree: each internal node splits one dimension in two at a rule boundary
+// The dimension and point follow the weighted segment heuristic of the HyperSplit paper
+class HyperSplitClassifier : public PacketClassifier {
+public:
+	HyperSplitClassifier(const std::unordered_map<std::string, std::string>& args);
+
+	void ConstructClassifier(const std::vector<Rule>& rules) override;
+	int ClassifyAPacket(const Packet& packet) const override;
+	void ClassifyPackets(const Packet* packets, size_t n, int* results) const override;
+
+	Memory MemSizeBytes() const override;
+	size_t NumTables() const override {
+		return 1;
+	}
+	size_t RulesInTable(size_t tableIndex) const override {
+		return numRules;
+	}
+	std::map<std::string, std::string> EngineStats() const override;
+private:
+	typedef std::array<Interval, NumDims> Region;
+	// Leaves have dim == Leaf and hold count rules starting at index; the children of a split are index and index + 1
+	struct HSNode {
+		uint32_t dim;
+		Point point;
+		uint32_t index;
+		uint32_t count;
+	};
+	static const uint32_t Leaf = ~0u;
+
+	void Build(size_t node, const std::vector<uint32_t>& rl, const Region& region, int depth);
+	bool ChooseSplit(const std::vector<uint32_t>& rl, const Region& region, uint32_t& dim, Point& point) const;
+
+	size_t binth;
+	size_t numRules = 0;
+	int height = 0;
+	std::vector<Rule> rules;
+	std::vector<HSNode> nodes;
+	std::vector<Rule> leafRules;
+};
+
+#endif
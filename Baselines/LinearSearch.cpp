@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "LinearSearch.h"
+
+using namespace std;
+
+void LinearSearchClassifier::ConstructClassifier(const vector<Rule>& rules) {
+	vector<Rule> sorted = rules;
+	SortRules(sorted);
+	numRules = sorted.size();
+	
+	// Padding rules match nothing, so every block is full
+	size_t padded = (numRules + BlockSize - 1) / BlockSize * BlockSize;
+	priorities.assign(padded, -1);
+	for (size_t d = 0; d < NumDims; d++) {
+		lows[d].assign(padded, 1);
+		highs[d].assign(padded, 0);
+	}
+	for (size_t i = 0; i < numRules; i++) {
+		priorities[i] = sorted[i].priority;
+		for (size_t d = 0; d < NumDims; d++) {
+			lows[d][i] = sorted[i].range[d].low;
+			highs[d][i] = sorted[i].range[d].high;
+		}
+	}
+}
+
+int LinearSearchClassifier::ClassifyAPacket(const Packet& packet) const {
+	for (size_t b = 0; b < priorities.size(); b += BlockSize) {
+		uint8_t match[BlockSize];
+		for (size_t j = 0; j < BlockSize; j++) {
+			match[j] = 1;
+		}
+		for (size_t d = 0; d < NumDims; d++) {
+			Point x = packet[d];
+			const Point* lo = lows[d].data() + b;
+			const Point* hi = highs[d].data() + b;
+			for (size_t j = 0; j < BlockSize; j++) {
+				match[j] &= (lo[j] <= x) & (x <= hi[j]);
+			}
+		}
+		for (size_t j = 0; j < BlockSize; j++) {
+			if (match[j]) {
+				return priorities[b + j];
+			}
+		}
+	}
+	return -1;
+}
+
+void LinearSearchClassifier::ClassifyPackets(const Packet* packets, size_t n, int* results) const {
+	for (size_t i = 0; i < n; i++) {
+		results[i] = LinearSearchClassifier::ClassifyAPacket(packets[i]);
+	}
+}
+
+Memory LinearSearchClassifier::MemSizeBytes() const {
+	Memory total = priorities.size() * sizeof(int);
+	for (size_t d = 0; d < NumDims; d++) {
+		total += (lows[d].size() + highs[d].size()) * sizeof(Point);
+	}
+	return total;
+}
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef LinearSearch_H
+#define LinearSearch_H
+
+#include "../Common.h"
+
+#include <unordered_map>
+
+// Baseline that scans the priority-sorted rules in blocks, comparing a block of rules in one dimension at a time
+// Bounds are stored per dimension so the comparisons over a block vectorize
+class LinearSearchClassifier : public PacketClassifier {
+public:
+	LinearSearchClassifier(const std::unordered_map<std::string, std::string>& args) {}
+
+	void ConstructClassifier(const std::vector<Rule>& rules) override;
+	int ClassifyAPacket(const Packet& packet) const override;
+	void ClassifyPackets(const Packet* packets, size_t n, int* results) const override;
+
+	Memory MemSizeBytes() const override;
+	size_t NumTables() const override {
+		return 1;
+	}
+	size_t RulesInTable(size_t tableIndex) const override {
+		return numRules;
+	}
+private:
+	static const size_t BlockSize = 16;
+
+	size_t numRules = 0;
+	std::vector<int> priorities;
+	std::array<std::vector<Point>, NumDims> lows;
+	std::array<std::vector<Point>, NumDims> highs;
+};
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "TupleSpace.h"
+
+using namespace std;
+
+static Point CommonPrefixMask(const Interval& range) {
+	Point diff = range.low ^ range.high;
+	if (diff == 0) return ~0u;
+	int length = __builtin_clz(diff);
+	return length == 0 ? 0 : ~0u << (POINT_SIZE_BITS - length);
+}
+
+void TupleSpaceClassifier::ConstructClassifier(const vector<Rule>& rules) {
+	vector<Rule> sorted = rules;
+	SortRules(sorted);
+	tuples.clear();
+	
+	map<Key, size_t> tupleOf;
+	for (const Rule& r : sorted) {
+		Key masks;
+		for (size_t d = 0; d < NumDims; d++) {
+			masks[d] = CommonPrefixMask(r.range[d]);
+		}
+		auto it = tupleOf.find(masks);
+		if (it == tupleOf.end()) {
+			it = tupleOf.insert(make_pair(masks, tuples.size())).first;
+			Tuple t;
+			t.masks = masks;
+			// Rules arrive in priority order, so tuples are created in order of their maximum
+			t.maxPriority = r.priority;
+			t.numRules = 0;
+			tuples.push_back(t);
+		}
+		Tuple& t = tuples[it->second];
+		Point low[NumDims];
+		for (size_t d = 0; d < NumDims; d++) {
+			low[d] = r.range[d].low;
+		}
+		t.buckets[t.Mask(low)].push_back(r);
+		t.numRules++;
+	}
+}
+
+int TupleSpaceClassifier::ClassifyAPacket(const Packet& packet) const {
+	int result = -1;
+	for (const Tuple& t : tuples) {
+		if (t.maxPriority <= result) break;
+		auto it = t.buckets.find(t.Mask(packet));
+		if (it == t.buckets.end()) continue;
+		for (const Rule& r : it->second) {
+			if (r.priority <= result) break;
+			if (r.MatchesPacket(packet)) {
+				result = r.priority;
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+void TupleSpaceClassifier::ClassifyPackets(const Packet* packets, size_t n, int* results) const {
+	for (size_t i = 0; i < n; i++) {
+		results[i] = TupleSpaceClassifier::ClassifyAPacket(packets[i]);
+	}
+}
+
+Memory TupleSpaceClassifier::MemSizeBytes() const {
+	Memory total = tuples.size() * sizeof(Tuple);
+	for (const Tuple& t : tuples) {
+		total += t.buckets.bucket_count() * sizeof(void*);
+		for (auto& pair : t.buckets) {
+			total += sizeof(pair) + sizeof(void*) + pair.second.size() * sizeof(Rule);
+		}
+	}
+	return total;
+}
+
+map<string, string> TupleSpaceClassifier::EngineStats() const {
+	size_t buckets = 0;
+	size_t largest = 0;
+	for (const Tuple& t : tuples) {
+		buckets += t.buckets.size();
+		for (auto& pair : t.buckets) {
+			largest = max(largest, pair.second.size());
+		}
+	}
+	printf("\tTuples: %lu, buckets: %lu, largest bucket: %lu\n", tuples.size(), buckets, largest);
+	return {{"Tuples", to_string(tuples.size())}, {"Buckets", to_string(buckets)}, {"LargestBucket", to_string(largest)}};
+}
@@ -0,0 +1,81 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef TupleSpace_H
+#define TupleSpace_H
+
+#include "../Common.h"
+
+#include <unordered_map>
+
+// Baseline Tuple Space Search with priority-sorted tuples
+// A rule's tuple is, per dimension, the length of the prefix shared by both ends of its range
+// Every rule sharing a tuple is hashed on those prefixes, and candidates are checked in full
+class TupleSpaceClassifier : public PacketClassifier {
+public:
+	TupleSpaceClassifier(const std::unordered_map<std::string, std::string>& args) {}
+
+	void ConstructClassifier(const std::vector<Rule>& rules) override;
+	int ClassifyAPacket(const Packet& packet) const override;
+	void ClassifyPackets(const Packet* packets, size_t n, int* results) const override;
+
+	Memory MemSizeBytes() const override;
+	size_t NumTables() const override {
+		return tuples.size();
+	}
+	size_t RulesInTable(size_t tableIndex) const override {
+		return tuples[tableIndex].numRules;
+	}
+	std::map<std::string, std::string> EngineStats() const override;
+private:
+	typedef std::array<Point, NumDims> Key;
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			size_t h = 0;
+			for (Point x : key) {
+				h = (h ^ x) * 0x9E3779B97F4A7C15ull;
+			}
+			return h ^ (h >> 29);
+		}
+	};
+	struct Tuple {
+		Key masks;
+		int maxPriority;
+		size_t numRules;
+		// Each bucket is sorted by decreasing priority
+		std::unordered_map<Key, std::vector<Rule>, KeyHash> buckets;
+		
+		Key Mask(const Point* p) const {
+			Key key;
+			for (size_t d = 0; d < NumDims; d++) {
+				key[d] = p[d] & masks[d];
+			}
+			return key;
+		}
+	};
+
+	std::vector<Tuple> tuples;
+};
+
+#endif
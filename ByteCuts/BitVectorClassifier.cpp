@@ -0,0 +1,192 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "BitVectorClassifier.h"
+
+#include <cstring>
+
+using namespace std;
+
+// Compiles to SIMD ANDs on whatever vector width the target offers
+typedef uint64_t Chunk __attribute__((vector_size(32)));
+
+static inline void AndChunk(Chunk& acc, const uint64_t* words) {
+	Chunk c;
+	memcpy(&c, words, sizeof(Chunk));
+	acc &= c;
+}
+
+// Starts of the elementary intervals of one dimension, in value order
+static void ElementaryStarts(const vector<Rule>& rules, size_t d, vector<Point>& starts) {
+	starts.push_back(0);
+	for (const Rule& r : rules) {
+		starts.push_back(r.range[d].low);
+		if (r.range[d].high != numeric_limits<Point>::max()) {
+			starts.push_back(r.range[d].high + 1);
+		}
+	}
+	sort(starts.begin(), starts.end());
+	starts.erase(unique(starts.begin(), starts.end()), starts.end());
+}
+
+size_t BitVectorClassifier::RowWords(size_t numRules) {
+	size_t chunks = max<size_t>(1, (numRules + RulesPerChunk - 1) / RulesPerChunk);
+	return (chunks + 63) / 64 + chunks * WordsPerChunk;
+}
+
+BitVectorClassifier::BitVectorClassifier(const vector<Rule>& rules) {
+	for (const Rule& r : rules) {
+		priorities.push_back(r.priority);
+	}
+	numChunks = max<size_t>(1, (rules.size() + RulesPerChunk - 1) / RulesPerChunk);
+	aggWords = (numChunks + 63) / 64;
+	rowWords = RowWords(rules.size());
+	
+	for (size_t d = 0; d < NumDims; d++) {
+		vector<Point>& starts = bounds[d];
+		ElementaryStarts(rules, d, starts);
+		
+		vector<uint64_t>& table = rows[d];
+		table.assign(starts.size() * rowWords, 0);
+		for (size_t i = 0; i < rules.size(); i++) {
+			size_t first = lower_bound(starts.begin(), starts.end(), rules[i].range[d].low) - starts.begin();
+			size_t last = upper_bound(starts.begin(), starts.end(), rules[i].range[d].high) - starts.begin();
+			for (size_t k = first; k < last; k++) {
+				uint64_t* row = table.data() + k * rowWords;
+				row[aggWords + i / 64] |= 1ull << (i % 64);
+				row[(i / RulesPerChunk) / 64] |= 1ull << ((i / RulesPerChunk) % 64);
+			}
+		}
+	}
+}
+
+int BitVectorClassifier::ClassifyAPacket(const Packet& p) const {
+	const uint64_t* row[NumDims];
+	for (size_t d = 0; d < NumDims; d++) {
+		row[d] = Row(d, p[d]);
+	}
+	for (size_t a = 0; a < aggWords; a++) {
+		uint64_t agg = row[0][a];
+		for (size_t d = 1; d < NumDims; d++) {
+			agg &= row[d][a];
+		}
+		while (agg) {
+			size_t c = a * 64 + __builtin_ctzll(agg);
+			size_t offset = aggWords + c * WordsPerChunk;
+			Chunk acc;
+			memcpy(&acc, row[0] + offset, sizeof(Chunk));
+			for (size_t d = 1; d < NumDims; d++) {
+				AndChunk(acc, row[d] + offset);
+			}
+			for (size_t w = 0; w < WordsPerChunk; w++) {
+				if (acc[w]) {
+					return priorities[(c * WordsPerChunk + w) * 64 + __builtin_ctzll(acc[w])];
+				}
+			}
+			agg &= agg - 1;
+		}
+	}
+	return -1;
+}
+
+void BitVectorClassifier::ClassifyAllMatches(const Packet& p, MatchBuffer& matches) const {
+	const uint64_t* row[NumDims];
+	for (size_t d = 0; d < NumDims; d++) {
+		row[d] = Row(d, p[d]);
+	}
+	for (size_t a = 0; a < aggWords; a++) {
+		uint64_t agg = row[0][a];
+		for (size_t d = 1; d < NumDims; d++) {
+			agg &= row[d][a];
+		}
+		while (agg) {
+			size_t c = a * 64 + __builtin_ctzll(agg);
+			size_t offset = aggWords + c * WordsPerChunk;
+			Chunk acc;
+			memcpy(&acc, row[0] + offset, sizeof(Chunk));
+			for (size_t d = 1; d < NumDims; d++) {
+				AndChunk(acc, row[d] + offset);
+			}
+			for (size_t w = 0; w < WordsPerChunk; w++) {
+				uint64_t bits = acc[w];
+				while (bits) {
+					int priority = priorities[(c * WordsPerChunk + w) * 64 + __builtin_ctzll(bits)];
+					// Later bits only have lower priorities
+					if (priority <= matches.Floor()) return;
+					matches.Add(priority);
+					bits &= bits - 1;
+				}
+			}
+			agg &= agg - 1;
+		}
+	}
+}
+
+size_t BitVectorClassifier::WorstCaseLines(const size_t* numBounds, size_t rowWords) {
+	// The object and one priority
+	size_t lines = BlockLines(sizeof(BitVectorClassifier), alignof(BitVectorClassifier)) + 1;
+	for (size_t d = 0; d < NumDims; d++) {
+		// Each probe of the binary search reads one aligned point, and a row may be scanned to its end
+		size_t probes = 64 - __builtin_clzll(numBounds[d]);
+		lines += min(probes, BlockLines(numBounds[d] * sizeof(Point), alignof(Point)));
+		lines += BlockLines(rowWords * sizeof(uint64_t), alignof(uint64_t));
+	}
+	return lines;
+}
+
+size_t BitVectorClassifier::WorstCaseLines() const {
+	size_t numBounds[NumDims];
+	for (size_t d = 0; d < NumDims; d++) {
+		numBounds[d] = bounds[d].size();
+	}
+	return WorstCaseLines(numBounds, rowWords);
+}
+
+size_t BitVectorClassifier::WorstCaseLines(const vector<Rule>& rules) {
+	size_t numBounds[NumDims];
+	for (size_t d = 0; d < NumDims; d++) {
+		vector<Point> starts;
+		ElementaryStarts(rules, d, starts);
+		numBounds[d] = starts.size();
+	}
+	return WorstCaseLines(numBounds, RowWords(rules.size()));
+}
+
+Memory BitVectorClassifier::MemSizeBytes() const {
+	Memory total = priorities.size() * sizeof(int);
+	for (size_t d = 0; d < NumDims; d++) {
+		total += bounds[d].size() * sizeof(Point) + rows[d].size() * sizeof(uint64_t);
+	}
+	return total;
+}
+
+Memory BitVectorClassifier::MemSizeBytes(const vector<Rule>& rules) {
+	Memory total = rules.size() * sizeof(int);
+	size_t rowWords = RowWords(rules.size());
+	for (size_t d = 0; d < NumDims; d++) {
+		vector<Point> starts;
+		ElementaryStarts(rules, d, starts);
+		total += starts.size() * (sizeof(Point) + rowWords * sizeof(uint64_t));
+	}
+	return total;
+}
@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef BitVectorClassifier_H
+#define BitVectorClassifier_H
+
+#include "ByteCutsNode.h"
+
+#include <array>
+
+// Aggregated bit vector classifier for a small, hard-to-cut set of rules
+// Each dimension is split into elementary intervals, each holding a bit vector of the rules
+// covering it; a lookup finds one interval per dimension and ANDs their vectors
+// Bits follow rule order, so the lowest set bit is the highest-priority match
+class BitVectorClassifier {
+public:
+	// Rules must be sorted by decreasing priority
+	BitVectorClassifier(const std::vector<Rule>& rules);
+
+	int ClassifyAPacket(const Packet& p) const;
+	void ClassifyAllMatches(const Packet& p, MatchBuffer& matches) const;
+
+	size_t NumRules() const { return priorities.size(); }
+	int MaxPriority() const { return priorities.empty() ? -1 : priorities[0]; }
+	// Priorities of the rules, highest first
+	const std::vector<int>& Priorities() const { return priorities; }
+	// Gives every rule the priority renumbered[old priority]; the mapping must keep their order
+	void Renumber(const std::vector<int>& renumbered) {
+		for (int& p : priorities) {
+			p = renumbered[p];
+		}
+	}
+	Memory MemSizeBytes() const;
+	// The same size for a rule set, without building its tables
+	static Memory MemSizeBytes(const std::vector<Rule>& rules);
+	// Most cache lines one lookup can touch: a binary search and a whole row per dimension, and a priority
+	size_t WorstCaseLines() const;
+	// The same bound for a rule set, without building its tables
+	static size_t WorstCaseLines(const std::vector<Rule>& rules);
+private:
+	// Rules are ANDed 256 at a time; the aggregate has one bit per chunk that has any rule
+	static const size_t WordsPerChunk = 4;
+	static const size_t RulesPerChunk = WordsPerChunk * 64;
+
+	// Row for the elementary interval holding x: aggregate words, then the rule bit vector
+	const uint64_t* Row(size_t dim, Point x) const {
+		const std::vector<Point>& starts = bounds[dim];
+		size_t index = std::upper_bound(starts.begin(), starts.end(), x) - starts.begin() - 1;
+		return rows[dim].data() + index * rowWords;
+	}
+
+	static size_t WorstCaseLines(const size_t* numBounds, size_t rowWords);
+	static size_t RowWords(size_t numRules);
+
+	std::vector<int> priorities;
+	size_t numChunks;
+	size_t aggWords;
+	size_t rowWords;
+	std::array<std::vector<Point>, NumDims> bounds;
+	std::array<std::vector<uint64_t>, NumDims> rows;
+};
+
+#endif
@@ -23,7 +23,10 @@
  */
 #include "ByteCuts.h"
 
+#include "../IO/InputReader.h"
+#include "../Utilities/BuildProfiler.h"
 #include "../Utilities/MapExtensions.h"
+#include "../Utilities/MemoryUsage.h"
 
 #include <limits>
 #include <unordered_map>
@@ -31,8 +34,6 @@
 
 using namespace std;
 
-#define MaxDelta 16
-
 ByteCutsClassifier::ByteCutsClassifier(const vector<Rule>& rules, const vector<ByteCutsNode*>& trees, const vector<int>& priorities, const vector<size_t>& sizes) : 
 		rules(rules), trees(trees), priorities(priorities), sizes(sizes) {
 }
@@ -40,16 +41,111 @@ ByteCutsClassifier::ByteCutsClassifier(const vector<Rule>& rules, const vector<B
 ByteCutsClassifier::ByteCutsClassifier(const unordered_map<string, string>& args) 
 	: dredgeFraction(GetDoubleOrElse(args, "BC.BadFraction", 0.02)),
 	turningPoint(GetDoubleOrElse(args, "BC.TurningPoint", 0.01)),
-	minFrac(GetDoubleOrElse(args, "BC.MinFraction", 0.75)) {
+	minFrac(GetDoubleOrElse(args, "BC.MinFraction", 0.75)),
+	leafSize(min<size_t>(GetUIntOrElse(args, "BC.LeafSize", 8), numeric_limits<uint8_t>::max())),
+	maxDelta(GetUIntOrElse(args, "BC.MaxDelta", MaxDelta)),
+	primaryPenalty(GetIntOrElse(args, "BC.PrimaryPenalty", 5)),
+	secondaryPenalty(GetIntOrElse(args, "BC.SecondaryPenalty", 1)),
+	compressCuts(GetBoolOrElse(args, "BC.CompressCuts", true)),
+	badEngine(GetOrElse(args, "BC.BadEngine", "Trees")),
+	costModel(GetOrElse(args, "BC.CostModel", "Rules")),
+	lockstep(min<size_t>(GetUIntOrElse(args, "BC.Lockstep", 1), MaxLockstep)),
+	usePortClasses(GetBoolOrElse(args, "BC.PortClasses", false)),
+	usePrefilter(GetBoolOrElse(args, "BC.Prefilter", false)),
+	hugePages(GetOrElse(args, "HugePages", "Off")),
+	trafficFile(GetOrElse(args, "BC.Traffic", "")),
+	trafficSample(GetUIntOrElse(args, "BC.TrafficSample", 10000)),
+	coldLeafSize(GetUIntOrElse(args, "BC.ColdLeafSize", 32)),
+	budget(GetBytesOrElse(args, "MemBudget", 0)),
+	maxTrees(GetUIntOrElse(args, "BC.MaxTrees", 0)),
+	maxAccesses(GetUIntOrElse(args, "BC.MaxAccesses", 0)),
+	maxDepth(GetIntOrElse(args, "BC.MaxDepth", 0)) {
 }
 
 ByteCutsClassifier::~ByteCutsClassifier() { 
-	for (ByteCutsNode* n : trees) {
-		delete n;
+	if (!treeArena) {
+		for (ByteCutsNode* n : trees) {
+			delete n;
+		}
+	}
+	delete treeArena;
+	delete bitVector;
+	delete portClasses;
+	for (Packet p : traffic) {
+		delete [] p;
+	}
+}
+
+void ByteCutsClassifier::LoadTraffic() {
+	if (trafficFile.empty() || !traffic.empty()) return;
+	
+	vector<Packet> packets = InputReader::ReadPackets(trafficFile);
+	// BC.TrafficSample=0 keeps the whole trace
+	size_t stride = trafficSample == 0 ? 1 : max<size_t>(1, (packets.size() + trafficSample - 1) / trafficSample);
+	for (size_t i = 0; i < packets.size(); i++) {
+		if (i % stride == 0) {
+			traffic.push_back(packets[i]);
+		} else {
+			delete [] packets[i];
+		}
+	}
+	// Samples are kept in the coordinates the trees are built and searched in
+	if (portClasses) {
+		for (Packet p : traffic) {
+			Point translated[NumDims];
+			copy_n(portClasses->Translate(p, translated), NumDims, p);
+		}
+	}
+	printf("Weighting construction by %lu sample packets\n", traffic.size());
+}
+
+void ByteCutsClassifier::OrderTreesByTraffic() {
+	// Trees that most often hold the winning rule go first so the priority check prunes the rest
+	vector<size_t> wins(trees.size(), 0);
+	for (Packet p : traffic) {
+		int result = -1;
+		size_t winner = trees.size();
+		for (size_t i = 0; i < trees.size(); i++) {
+			if (priorities[i] > result) {
+				int r = trees[i]->ClassifyAPacket(p);
+				if (r > result) {
+					result = r;
+					winner = i;
+				}
+			}
+		}
+		if (winner < trees.size()) {
+			wins[winner]++;
+		}
+	}
+	
+	vector<size_t> order(trees.size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return wins[x] > wins[y]; });
+	
+	vector<ByteCutsNode*> orderedTrees;
+	vector<int> orderedPriorities;
+	vector<size_t> orderedSizes;
+	vector<bool> orderedBad;
+	vector<TreeFilter> orderedFilters;
+	for (size_t i : order) {
+		orderedTrees.push_back(trees[i]);
+		orderedPriorities.push_back(priorities[i]);
+		orderedSizes.push_back(sizes[i]);
+		orderedBad.push_back(badTree[i]);
+		if (!filters.empty()) {
+			orderedFilters.push_back(filters[i]);
+		}
 	}
+	trees = orderedTrees;
+	priorities = orderedPriorities;
+	sizes = orderedSizes;
+	badTree = orderedBad;
+	filters = orderedFilters;
 }
 
-vector<Rule> ByteCutsClassifier::Separate(const vector<Rule>& rules, vector<Rule>& remain) {
+vector<RuleIndex> ByteCutsClassifier::Separate(const vector<RuleIndex>& rules, vector<RuleIndex>& remain) {
+	ProfileScope scope("Separate", rules.size(), SampleRss);
 	int bestDim = -1;
 	uint8_t bestLen = 0;
 	size_t bestCost = numeric_limits<size_t>::max();
@@ -57,13 +153,17 @@ vector<Rule> ByteCutsClassifier::Separate(const vector<Rule>& rules, vector<Rule
 	size_t bestRemain = numeric_limits<size_t>::max();
 	
 	
-	vector<int> dims = {FieldSA, FieldDA};
+	vector<int> dims;
+	for (int w = 0; w < 2 * WordsPerAddress; w++) {
+		dims.push_back(FieldSA + w);
+	}
 	for (int d : dims) {
 		for (uint8_t len = BitsPerNybble; len <= BitsPerField; len += BitsPerNybble) {
 			unordered_map<Point, size_t> counts;
 			size_t dropped = 0;
 			
-			for (const Rule& r : rules) {
+			for (RuleIndex i : rules) {
+				const Rule& r = this->rules[i];
 				if (r.prefix_length[d] >= len) {
 					Point x = r.range[d].low & (0xFFFFFFFF << (BitsPerField - len));
 					counts[x]++;
@@ -109,12 +209,12 @@ vector<Rule> ByteCutsClassifier::Separate(const vector<Rule>& rules, vector<Rule
 			}
 		}
 	}
-	vector<Rule> results;
-	for (const Rule& r : rules) {
-		if (r.prefix_length[bestDim] >= bestLen) {
-			results.push_back(r);
+	vector<RuleIndex> results;
+	for (RuleIndex i : rules) {
+		if (this->rules[i].prefix_length[bestDim] >= bestLen) {
+			results.push_back(i);
 		} else {
-			remain.push_back(r);
+			remain.push_back(i);
 		}
 	}
 	
@@ -122,66 +222,617 @@ vector<Rule> ByteCutsClassifier::Separate(const vector<Rule>& rules, vector<Rule
 }
 
 void ByteCutsClassifier::ConstructClassifier(const std::vector<Rule>& rules) {
+	ProfileScope scope("ConstructClassifier", rules.size(), SampleRss);
+	if (costModel != "Rules" && costModel != "Cache") {
+		printf("Unknown BC.CostModel: %s\n", costModel.c_str());
+		exit(EXIT_FAILURE);
+	}
+	// The trace and anything built before are already resident, so only the growth over them is the build's
+	Memory entryRss = CurrentRssBytes();
+	ResetPeakRss();
 	this->rules = rules;
 	SortRules(this->rules);
+	if (usePortClasses) {
+		ProfileScope classes("PortClasses", this->rules.size(), SampleRss);
+		portClasses = new PortClasses(this->rules);
+		for (const Rule& r : this->rules) {
+			treeRules.push_back(portClasses->Translate(r));
+		}
+		for (size_t i = 0; i < portClasses->NumTables(); i++) {
+			printf("Dimension %u: %lu classes\n", portClasses->DimOfTable(i), portClasses->NumClasses(i));
+		}
+		budget.Charge(portClasses->MemSizeBytes());
+	}
+	LoadTraffic();
 	
-	vector<Rule> rl = this->rules;
-	vector<vector<Rule>> parts;
+	vector<RuleIndex> rl(this->rules.size());
+	iota(rl.begin(), rl.end(), 0);
+	vector<RuleIndex> vectorRules = BuildForest(rl);
+	if (HasLookupBounds()) {
+		EnforceBounds(vectorRules);
+	}
+	BuildBitVector(vectorRules);
 	
-	while (rl.size() > rules.size() * dredgeFraction) {
-		vector<Rule> remain;
+	if (!traffic.empty()) {
+		OrderTreesByTraffic();
+	}
+	if (hugePages != "Off") {
+		Freeze();
+	}
+	Memory peakRss = PeakRssBytes();
+	peakBuildRss = peakRss > entryRss ? peakRss - entryRss : 0;
+	// Leaves hold their own copies of the translated rules
+	vector<Rule>().swap(treeRules);
+}
+
+vector<RuleIndex> ByteCutsClassifier::BuildForest(vector<RuleIndex> rl) {
+	size_t numRules = rl.size();
+	vector<vector<RuleIndex>> parts;
+	while (rl.size() > numRules * dredgeFraction) {
+		vector<RuleIndex> remain;
 		parts.push_back(Separate(rl, remain));
 		if (remain.size() == rl.size()) break;
-		rl = remain;
+		rl.swap(remain);
+	}
+	
+	// Rules that go to the bit vector engine in any case hold back room for its tables before the trees are built
+	bool vectorBad = badEngine == "BitVector";
+	if (HasBudget() && vectorBad) {
+		ReserveBitVector(rl);
+	}
+	vector<RuleIndex> overflow;
+	for (vector<RuleIndex>& part : parts) {
+		size_t before = overflow.size();
+		BuildTree(part, overflow);
+		// Each rule a tree could not take widens the engine's rows, so the charge grows with them
+		if (HasBudget() && overflow.size() > before) {
+			vector<RuleIndex> vectorRules = overflow;
+			if (vectorBad) {
+				vectorRules.insert(vectorRules.end(), rl.begin(), rl.end());
+			}
+			ReserveBitVector(vectorRules);
+		}
+	}
+	if (badEngine == "Trees") {
+		BuildBadTree(rl, overflow);
+		rl.clear();
+	} else if (!vectorBad) {
+		printf("Unknown BC.BadEngine: %s\n", badEngine.c_str());
+		exit(EXIT_FAILURE);
+	}
+	overBudgetRules = overflow.size();
+	rl.insert(rl.end(), overflow.begin(), overflow.end());
+	return rl;
+}
+
+// Rules are paired across versions by the ranges they match, whatever their priority
+struct RuleFieldsHash {
+	size_t operator()(const Rule* r) const {
+		size_t h = 0;
+		for (size_t d = 0; d < NumDims; d++) {
+			h = (h ^ r->range[d].low) * 0x9E3779B97F4A7C15ull;
+			h = (h ^ r->range[d].high) * 0x9E3779B97F4A7C15ull;
+		}
+		return h;
+	}
+};
+
+struct RuleFieldsEqual {
+	bool operator()(const Rule* x, const Rule* y) const {
+		for (size_t d = 0; d < NumDims; d++) {
+			if (x->range[d].low != y->range[d].low || x->range[d].high != y->range[d].high) return false;
+		}
+		return true;
+	}
+};
+
+// Marks a longest strictly increasing subsequence of xs
+static vector<bool> LongestIncreasing(const vector<RuleIndex>& xs) {
+	// tails[k] is the position ending the best run of length k + 1 found so far
+	vector<size_t> tails, parent(xs.size(), xs.size());
+	for (size_t i = 0; i < xs.size(); i++) {
+		size_t k = lower_bound(tails.begin(), tails.end(), xs[i], [&](size_t t, RuleIndex x) { return xs[t] < x; }) - tails.begin();
+		if (k > 0) parent[i] = tails[k - 1];
+		if (k == tails.size()) tails.push_back(i);
+		else tails[k] = i;
+	}
+	vector<bool> in(xs.size(), false);
+	for (size_t i = tails.empty() ? xs.size() : tails.back(); i < xs.size(); i = parent[i]) {
+		in[i] = true;
+	}
+	return in;
+}
+
+RuleUpdate ByteCutsClassifier::Update(const vector<Rule>& rules) {
+	ProfileScope scope("Update", rules.size(), SampleRss);
+	RuleUpdate update;
+	vector<Rule> next = rules;
+	SortRules(next);
+	
+	// Each new rule takes the earliest unpaired old rule with the same fields
+	unordered_map<const Rule*, vector<RuleIndex>, RuleFieldsHash, RuleFieldsEqual> unpaired;
+	for (size_t i = this->rules.size(); i-- > 0;) {
+		unpaired[&this->rules[i]].push_back(i);
+	}
+	vector<RuleIndex> added, keptNew, keptOld;
+	for (size_t j = 0; j < next.size(); j++) {
+		auto it = unpaired.find(&next[j]);
+		if (it == unpaired.end() || it->second.empty()) {
+			added.push_back(j);
+		} else {
+			keptNew.push_back(j);
+			keptOld.push_back(it->second.back());
+			it->second.pop_back();
+		}
+	}
+	update.added = added.size();
+	update.removed = this->rules.size() - keptOld.size();
+	
+	// Leaves are first-match, so kept rules must stay in order; the longest run that does keeps its place
+	vector<int> renumbered(this->rules.empty() ? 0 : this->rules[0].priority + 1, -1);
+	vector<bool> inOrder = LongestIncreasing(keptOld);
+	for (size_t k = 0; k < keptNew.size(); k++) {
+		if (inOrder[k]) {
+			renumbered[this->rules[keptOld[k]].priority] = next[keptNew[k]].priority;
+		} else {
+			added.push_back(keptNew[k]);
+			update.moved++;
+		}
+	}
+	vector<RuleIndex> indexOf(next.empty() ? 0 : next[0].priority + 1);
+	for (size_t j = 0; j < next.size(); j++) {
+		indexOf[next[j].priority] = j;
+	}
+	
+	if (treeArena) {
+		Thaw();
+	}
+	// Removed rules are dropped from the leaves in place; a tree left empty goes
+	vector<vector<RuleIndex>> survivors(trees.size());
+	for (size_t t = trees.size(); t-- > 0;) {
+		vector<int> stored;
+		trees[t]->CollectPriorities(stored);
+		for (int p : stored) {
+			if (renumbered[p] >= 0) survivors[t].push_back(indexOf[renumbered[p]]);
+		}
+		CleanRules(survivors[t]);
+		if (survivors[t].empty()) {
+			RemoveTree(t);
+			survivors.erase(survivors.begin() + t);
+			update.droppedTrees++;
+			continue;
+		}
+		trees[t]->Renumber(renumbered);
+		// Rules a tree pushed out may be gone, so its bound now comes from the rules it stores
+		priorities[t] = next[survivors[t].front()].priority;
+		sizes[t] = survivors[t].size();
 	}
 	
-	for (vector<Rule>& part : parts) {
-		BuildTree(part);
+	// Added rules go to new trees; trees no larger than the rules being built are folded in,
+	// so repeated updates grow trees geometrically instead of piling up small ones
+	vector<RuleIndex> rebuild = added;
+	vector<size_t> bySize(trees.size());
+	iota(bySize.begin(), bySize.end(), 0);
+	stable_sort(bySize.begin(), bySize.end(), [&](size_t x, size_t y) { return survivors[x].size() < survivors[y].size(); });
+	vector<size_t> folded;
+	for (size_t t : bySize) {
+		if (rebuild.empty() || survivors[t].size() > rebuild.size()) break;
+		rebuild.insert(rebuild.end(), survivors[t].begin(), survivors[t].end());
+		folded.push_back(t);
+	}
+	sort(folded.begin(), folded.end(), greater<size_t>());
+	for (size_t t : folded) {
+		RemoveTree(t);
+		update.droppedTrees++;
+	}
+	update.keptTrees = trees.size();
+	if (bitVector) {
+		const vector<int>& stored = bitVector->Priorities();
+		if (any_of(stored.begin(), stored.end(), [&](int p) { return renumbered[p] < 0; })) {
+			for (int p : stored) {
+				if (renumbered[p] >= 0) rebuild.push_back(indexOf[renumbered[p]]);
+			}
+			delete bitVector;
+			bitVector = nullptr;
+			update.rebuiltBitVector = true;
+		} else {
+			bitVector->Renumber(renumbered);
+		}
+	}
+	
+	this->rules.swap(next);
+	CleanRules(rebuild);
+	vector<RuleIndex> vectorRules = BuildForest(rebuild);
+	update.builtTrees = trees.size() - update.keptTrees;
+	if (!vectorRules.empty()) {
+		// The bit vector engine cannot take rules one at a time, so a kept one is rebuilt with the new rules
+		if (bitVector) {
+			for (int p : bitVector->Priorities()) {
+				vectorRules.push_back(indexOf[p]);
+			}
+			delete bitVector;
+			bitVector = nullptr;
+			update.rebuiltBitVector = true;
+		}
+		BuildBitVector(vectorRules);
+	}
+	
+	if (!traffic.empty()) {
+		OrderTreesByTraffic();
+	}
+	if (hugePages != "Off") {
+		Freeze();
+	}
+	return update;
+}
+
+void ByteCutsClassifier::CopyConfiguration(const ByteCutsClassifier& other) {
+	dredgeFraction = other.dredgeFraction;
+	turningPoint = other.turningPoint;
+	minFrac = other.minFrac;
+	leafSize = other.leafSize;
+	maxDelta = other.maxDelta;
+	primaryPenalty = other.primaryPenalty;
+	secondaryPenalty = other.secondaryPenalty;
+	compressCuts = other.compressCuts;
+	badEngine = other.badEngine;
+	costModel = other.costModel;
+	lockstep = other.lockstep;
+	usePortClasses = other.usePortClasses;
+	usePrefilter = other.usePrefilter;
+	hugePages = other.hugePages;
+	trafficFile = other.trafficFile;
+	trafficSample = other.trafficSample;
+	coldLeafSize = other.coldLeafSize;
+	budget = other.budget;
+	maxTrees = other.maxTrees;
+	maxAccesses = other.maxAccesses;
+	maxDepth = other.maxDepth;
+}
+
+ByteCutsClassifier* ByteCutsClassifier::Replicate() const {
+	vector<ByteCutsNode*> copies;
+	for (const ByteCutsNode* t : trees) {
+		copies.push_back(t->Clone());
+	}
+	ByteCutsClassifier* copy = new ByteCutsClassifier(rules, copies, priorities, sizes);
+	copy->CopyConfiguration(*this);
+	copy->badTree = badTree;
+	copy->bitVector = bitVector ? new BitVectorClassifier(*bitVector) : nullptr;
+	copy->portClasses = portClasses ? new PortClasses(*portClasses) : nullptr;
+	copy->peakBuildRss = peakBuildRss;
+	copy->overBudgetRules = overBudgetRules;
+	copy->mergedTrees = mergedTrees;
+	copy->filters = filters;
+	if (treeArena) {
+		copy->Freeze();
+	}
+	return copy;
+}
+
+void ByteCutsClassifier::Freeze() {
+	ProfileScope scope("Freeze", 0, SampleRss);
+	// Trees no longer change once built, so they are packed into huge pages in one pass
+	treeArena = new HugePageArena(hugePages);
+	for (ByteCutsNode*& t : trees) {
+		ByteCutsNode* frozen = t->CloneInto(*treeArena);
+		delete t;
+		t = frozen;
 	}
-	BuildBadTree(rl);
 }
 
-void ByteCutsClassifier::BuildTree(const vector<Rule>& rules) {
-	vector<Rule> rl = rules;
+void ByteCutsClassifier::Thaw() {
+	// Frozen trees cannot be freed one at a time, so they return to the heap until the next Freeze
+	for (ByteCutsNode*& t : trees) {
+		t = t->Clone();
+	}
+	delete treeArena;
+	treeArena = nullptr;
+}
+
+void ByteCutsClassifier::ConfigureBuilder(TreeBuilder& bc) {
+	bc.SetCompressCuts(compressCuts);
+	bc.SetMaxDelta(maxDelta);
+	bc.SetPenaltyRates(primaryPenalty, secondaryPenalty);
+	bc.SetCacheCost(costModel == "Cache");
+	if (HasBudget()) {
+		bc.SetBudget(&budget);
+	}
+	if (portClasses) {
+		bc.SetCutPorts();
+		// Header values translate to the classes below the one past the table
+		for (size_t i = 0; i < portClasses->NumTables(); i++) {
+			bc.SetDomain(portClasses->DimOfTable(i), Interval{0, Point(portClasses->NumClasses(i) - 1)});
+		}
+	}
+	if (maxDepth > 0) {
+		bc.SetMaxDepth(maxDepth);
+	}
+	if (!trafficFile.empty()) {
+		bc.SetTraffic(traffic, coldLeafSize);
+	}
+}
+
+void ByteCutsClassifier::AddTree(ByteCutsNode* tree, const vector<RuleIndex>& rules, const vector<RuleIndex>& remain, bool bad) {
+	trees.push_back(tree);
+	badTree.push_back(bad);
+	priorities.push_back(MaxPriority(rules));
+	sizes.push_back(rules.size());
+	if (usePrefilter || HasLookupBounds()) {
+		// The tree holds the rules it was given less the ones it pushed out to the next tree
+		vector<RuleIndex> given = rules, pushed = remain, held;
+		sort(given.begin(), given.end());
+		sort(pushed.begin(), pushed.end());
+		set_difference(given.begin(), given.end(), pushed.begin(), pushed.end(), back_inserter(held));
+		if (usePrefilter) {
+			filters.push_back(TreeFilter(TreeRules(), held));
+			budget.Charge(filters.back().MemSizeBytes());
+		}
+		if (HasLookupBounds()) {
+			heldRules.push_back(move(held));
+		}
+	}
+}
+
+void ByteCutsClassifier::BuildTree(const vector<RuleIndex>& rules, vector<RuleIndex>& overflow) {
+	ProfileScope scope("BuildTree", rules.size(), SampleRss);
+	vector<RuleIndex> rl = rules;
 	while (!rl.empty()) {
-		goodTrees++;
-		TreeBuilder bc(8);
-		vector<Rule> remain;
-		trees.push_back(bc.BuildPrimaryRoot(rl, remain));
-		int priority = max_element(rl.begin(), rl.end(), [](auto rx, auto ry) { return rx.priority < ry.priority; })->priority;
-		priorities.push_back(priority);
-		sizes.push_back(rl.size());
-		rl = remain;
-		
+		if (OverBudget()) {
+			overflow.insert(overflow.end(), rl.begin(), rl.end());
+			return;
+		}
+		TreeBuilder bc(TreeRules(), leafSize);
+		ConfigureBuilder(bc);
+		vector<RuleIndex> remain;
+		AddTree(bc.BuildPrimaryRoot(rl, remain), rl, remain, false);
+		rl.swap(remain);
 	}
 }
 
-void ByteCutsClassifier::BuildBadTree(const vector<Rule>& rules) {
-	vector<Rule> rl = rules;
+void ByteCutsClassifier::BuildBadTree(const vector<RuleIndex>& rules, vector<RuleIndex>& overflow) {
+	ProfileScope scope("BuildBadTree", rules.size(), SampleRss);
+	vector<RuleIndex> rl = rules;
 	while (!rl.empty()) {
-		badTrees++;
-		TreeBuilder bc(8);
-		vector<Rule> remain;
-		trees.push_back(bc.BuildSecondaryRoot(rl, remain));
-		int priority = max_element(rl.begin(), rl.end(), [](auto rx, auto ry) { return rx.priority < ry.priority; })->priority;
-		priorities.push_back(priority);
-		sizes.push_back(rl.size());
-		rl = remain;
+		if (OverBudget()) {
+			overflow.insert(overflow.end(), rl.begin(), rl.end());
+			return;
+		}
+		TreeBuilder bc(TreeRules(), leafSize);
+		ConfigureBuilder(bc);
+		vector<RuleIndex> remain;
+		AddTree(bc.BuildSecondaryRoot(rl, remain), rl, remain, true);
+		rl.swap(remain);
 	}
 }
 
-int ByteCutsClassifier::ClassifyAPacket(const Packet& packet) {
-	int result = -1;
+void ByteCutsClassifier::BuildBitVector(const vector<RuleIndex>& rules) {
+	ProfileScope scope("BuildBitVector", rules.size(), SampleRss);
+	if (rules.empty()) return;
+	vector<RuleIndex> rl = rules;
+	sort(rl.begin(), rl.end());
+	vector<Rule> remain;
+	for (RuleIndex i : rl) {
+		remain.push_back(this->rules[i]);
+	}
+	bitVector = new BitVectorClassifier(remain);
+	// The estimate made while the trees were built gives way to the tables as built
+	budget.Refund(vectorBytes);
+	vectorBytes = bitVector->MemSizeBytes();
+	budget.Charge(vectorBytes);
+}
+
+size_t ByteCutsClassifier::TreeLines(size_t tree, bool frozen) const {
+	size_t lines = trees[tree]->WorstCaseLines(frozen);
+	if (!filters.empty()) {
+		lines += filters[tree].WorstCaseLines();
+	}
+	return lines;
+}
+
+size_t ByteCutsClassifier::ForestLines(size_t numTrees, size_t treeLines, size_t vectorLines) const {
+	// Every lookup may read the whole tree and priority arrays, then every tree and the bit vector
+	size_t lines = BlockLines(sizeof(ByteCutsClassifier), alignof(ByteCutsClassifier));
+	lines += BlockLines(numTrees * sizeof(ByteCutsNode*), alignof(ByteCutsNode*));
+	lines += BlockLines(numTrees * sizeof(int), alignof(int));
+	if (portClasses) {
+		lines += portClasses->WorstCaseLines();
+	}
+	return lines + treeLines + vectorLines;
+}
+
+size_t ByteCutsClassifier::VectorLines(const vector<RuleIndex>& rules) const {
+	if (rules.empty()) return 0;
+	vector<Rule> rs;
+	for (RuleIndex i : rules) {
+		rs.push_back(this->rules[i]);
+	}
+	return BitVectorClassifier::WorstCaseLines(rs);
+}
+
+void ByteCutsClassifier::ReserveBitVector(const vector<RuleIndex>& rules) {
+	vector<Rule> rs;
+	for (RuleIndex i : rules) {
+		rs.push_back(this->rules[i]);
+	}
+	budget.Refund(vectorBytes);
+	vectorBytes = BitVectorClassifier::MemSizeBytes(rs);
+	budget.Charge(vectorBytes);
+}
+
+size_t ByteCutsClassifier::WorstCaseLines() const {
+	size_t treeLines = 0;
+	for (size_t i = 0; i < trees.size(); i++) {
+		treeLines += TreeLines(i, false);
+	}
+	return ForestLines(trees.size(), treeLines, bitVector ? bitVector->WorstCaseLines() : 0);
+}
+
+void ByteCutsClassifier::RemoveTree(size_t tree) {
+	delete trees[tree];
+	trees.erase(trees.begin() + tree);
+	priorities.erase(priorities.begin() + tree);
+	sizes.erase(sizes.begin() + tree);
+	badTree.erase(badTree.begin() + tree);
+	if (!heldRules.empty()) {
+		heldRules.erase(heldRules.begin() + tree);
+	}
+	if (!filters.empty()) {
+		filters.erase(filters.begin() + tree);
+	}
+}
+
+void ByteCutsClassifier::EnforceBounds(vector<RuleIndex>& vectorRules) {
+	ProfileScope scope("EnforceBounds", trees.size(), SampleRss);
+	// Lines are counted as the trees will be laid out after any Freeze
+	bool frozen = hugePages != "Off";
+	vector<size_t> lines;
 	for (size_t i = 0; i < trees.size(); i++) {
-		if (priorities[i] > result) {
-			ByteCutsNode* tree = trees[i];
-			result = max(result, tree->ClassifyAPacket(packet));
+		lines.push_back(TreeLines(i, frozen));
+	}
+	size_t vectorLines = VectorLines(vectorRules);
+	
+	while (!trees.empty()) {
+		size_t treeLines = accumulate(lines.begin(), lines.end(), size_t(0));
+		size_t current = ForestLines(trees.size(), treeLines, vectorLines);
+		size_t structures = trees.size() + (vectorRules.empty() ? 0 : 1);
+		bool tooMany = maxTrees > 0 && structures > maxTrees;
+		bool tooSlow = maxAccesses > 0 && current > maxAccesses;
+		if (!tooMany && !tooSlow) break;
+		
+		// Merge the tree whose move leaves the fewest lines; the bit vector grows with each rule it takes
+		size_t best = trees.size();
+		size_t bestLines = numeric_limits<size_t>::max();
+		size_t bestVectorLines = 0;
+		for (size_t i = 0; i < trees.size(); i++) {
+			vector<RuleIndex> merged = vectorRules;
+			merged.insert(merged.end(), heldRules[i].begin(), heldRules[i].end());
+			size_t candidateVector = VectorLines(merged);
+			size_t candidate = ForestLines(trees.size() - 1, treeLines - lines[i], candidateVector);
+			if (candidate < bestLines) {
+				best = i;
+				bestLines = candidate;
+				bestVectorLines = candidateVector;
+			}
+		}
+		// Only the tree count forces a move that makes the worst case longer
+		if (!tooMany && bestLines >= current) break;
+		
+		vectorRules.insert(vectorRules.end(), heldRules[best].begin(), heldRules[best].end());
+		vectorLines = bestVectorLines;
+		lines.erase(lines.begin() + best);
+		RemoveTree(best);
+		mergedTrees++;
+	}
+	vector<vector<RuleIndex>>().swap(heldRules);
+}
+
+int ByteCutsClassifier::MaxPriority(const vector<RuleIndex>& rules) const {
+	int priority = -1;
+	for (RuleIndex i : rules) {
+		priority = max(priority, this->rules[i].priority);
+	}
+	return priority;
+}
+
+int ByteCutsClassifier::ClassifyAPacket(const Packet& packet) const {
+	Point translated[NumDims];
+	Packet p = portClasses ? portClasses->Translate(packet, translated) : packet;
+	int result = -1;
+	if (lockstep > 1) {
+		result = ClassifyInLockstep(p);
+	} else {
+		for (size_t i = 0; i < trees.size(); i++) {
+			if (priorities[i] > result && MayMatch(i, p)) {
+				ByteCutsNode* tree = trees[i];
+				result = max(result, tree->ClassifyAPacket(p));
+			}
+		}
+	}
+	if (bitVector && bitVector->MaxPriority() > result) {
+		result = max(result, bitVector->ClassifyAPacket(packet));
+	}
+	return result;
+}
+
+int ByteCutsClassifier::ClassifyInLockstep(const Packet& p) const {
+	int result = -1;
+	const ByteCutsNode* lanes[MaxLockstep];
+	size_t next = 0;
+	while (next < trees.size()) {
+		// Take the next trees that could still beat the result found so far
+		size_t numLanes = 0;
+		for (; next < trees.size() && numLanes < lockstep; next++) {
+			if (priorities[next] > result && MayMatch(next, p)) {
+				lanes[numLanes++] = trees[next];
+			}
+		}
+		
+		// Each pass moves every lane down one level, so the lanes' cache misses overlap
+		bool descending = true;
+		while (descending) {
+			descending = false;
+			for (size_t j = 0; j < numLanes; j++) {
+				if (!lanes[j]->IsLeaf()) {
+					lanes[j] = lanes[j]->Next(p);
+					__builtin_prefetch(lanes[j]);
+					descending = true;
+				}
+			}
+		}
+		for (size_t j = 0; j < numLanes; j++) {
+			lanes[j]->PrefetchRules();
+		}
+		for (size_t j = 0; j < numLanes; j++) {
+			result = max(result, lanes[j]->ClassifyAPacket(p));
 		}
 	}
 	return result;
 }
 
+void ByteCutsClassifier::ClassifyPackets(const Packet* packets, size_t n, int* results) const {
+	for (size_t i = 0; i < n; i++) {
+		results[i] = ByteCutsClassifier::ClassifyAPacket(packets[i]);
+	}
+}
+
 bool ByteCutsClassifier::IsWideAddress(Interval s) const {
 	return (s.low + 0xFFFF) < s.high;
 }
 
+
+double ByteCutsClassifier::PrefilterRejectRate(const vector<Packet>& packets) const {
+	size_t candidates = 0, rejected = 0;
+	for (const Packet& packet : packets) {
+		Point translated[NumDims];
+		Packet p = portClasses ? portClasses->Translate(packet, translated) : packet;
+		int result = -1;
+		for (size_t i = 0; i < trees.size(); i++) {
+			if (priorities[i] <= result) continue;
+			candidates++;
+			if (MayMatch(i, p)) {
+				result = max(result, trees[i]->ClassifyAPacket(p));
+			} else {
+				rejected++;
+			}
+		}
+	}
+	return candidates ? rejected * 1.0 / candidates : 0;
+}
+
+size_t ByteCutsClassifier::ClassifyAllMatches(const Packet& packet, int* out, size_t capacity) const {
+	// Rules can be replicated across trees; the buffer keeps each once
+	MatchBuffer matches(out, capacity);
+	Point translated[NumDims];
+	Packet p = portClasses ? portClasses->Translate(packet, translated) : packet;
+	for (size_t i = 0; i < trees.size(); i++) {
+		if (priorities[i] > matches.Floor() && MayMatch(i, p)) {
+			trees[i]->ClassifyAllMatches(p, matches);
+		}
+	}
+	if (bitVector && bitVector->MaxPriority() > matches.Floor()) {
+		bitVector->ClassifyAllMatches(packet, matches);
+	}
+	sort(out, out + matches.count, greater<int>());
+	return matches.count;
+}
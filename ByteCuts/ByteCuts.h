@@ -27,52 +27,185 @@
 
 #include "ByteCutsNode.h"
 #include "TreeBuilder.h"
+#include "BitVectorClassifier.h"
+#include "PortClasses.h"
+#include "TreeFilter.h"
+#include "../Utilities/HugePages.h"
 
-class ByteCutsClassifier {
+// Most trees that one packet descends at the same time
+#define MaxLockstep 8
+
+// What Update changed, counted against the previous rule list
+struct RuleUpdate {
+	size_t added = 0;
+	size_t removed = 0;
+	// Kept rules whose order among the other kept rules changed; they are rebuilt like added ones
+	size_t moved = 0;
+	size_t keptTrees = 0;
+	size_t droppedTrees = 0;
+	size_t builtTrees = 0;
+	bool rebuiltBitVector = false;
+};
+
+class ByteCutsClassifier : public PacketClassifier {
 public:
 	ByteCutsClassifier(const std::vector<Rule>& rules, const std::vector<ByteCutsNode*>& trees, const std::vector<int>& priorities, const std::vector<size_t>& sizes);
 	ByteCutsClassifier(const std::unordered_map<std::string, std::string>& args);
+	ByteCutsClassifier(const ByteCutsClassifier&) = delete;
+	ByteCutsClassifier& operator=(const ByteCutsClassifier&) = delete;
 	~ByteCutsClassifier();
 
-	void ConstructClassifier(const std::vector<Rule>& rules);
-	int ClassifyAPacket(const Packet& packet);
+	void ConstructClassifier(const std::vector<Rule>& rules) override;
+	// Moves a constructed classifier to a new rule list, pairing rules by their fields rather than their position
+	// Trees holding a removed or reordered rule are rebuilt with the added rules; the rest only get new priorities
+	RuleUpdate Update(const std::vector<Rule>& rules);
+	// Class tables, memory budgets and lookup bounds are derived from the whole rule list, so they need a full build
+	bool CanUpdate() const {
+		return !usePortClasses && !HasBudget() && !HasLookupBounds();
+	}
+	// Deep copy of the constructed forest, allocated by the calling thread
+	ByteCutsClassifier* Replicate() const;
+	int ClassifyAPacket(const Packet& packet) const override;
+	void ClassifyPackets(const Packet* packets, size_t n, int* results) const override;
+	// Writes the priorities of up to capacity distinct matching rules, highest first, and returns how many
+	size_t ClassifyAllMatches(const Packet& packet, int* out, size_t capacity) const;
 	
-	Memory MemSizeBytes() const {
-		Memory mem = 0;
-		int rulesize = 19;
+	Memory MemSizeBytes() const override {
+		return Stats().TotalBytes();
+	}
+	TreeStats Stats() const {
+		TreeStats stats;
 		for (const ByteCutsNode* t : trees) {
-			mem += t->Size(rulesize);
+			stats.Add(t->Stats());
 		}
-		return mem;
+		if (bitVector) {
+			stats.bitVectorBytes = bitVector->MemSizeBytes();
+		}
+		if (portClasses) {
+			stats.classTableBytes = portClasses->MemSizeBytes();
+		}
+		for (const TreeFilter& f : filters) {
+			stats.filterBytes += f.MemSizeBytes();
+		}
+		return stats;
+	}
+	TreeStats StatsOfTree(size_t tableIndex) const {
+		return trees[tableIndex]->Stats();
 	}
-	size_t NumTables() const {
+	// Where the frozen trees live: "heap", or the page backing their arena actually got
+	std::string TreeBacking() const {
+		return treeArena ? treeArena->Backing() : "heap";
+	}
+	// Most the resident set grew during ConstructClassifier over what was resident on entry
+	// Where the kernel cannot restart the high-water mark, an earlier peak makes this an upper bound
+	Memory PeakBuildRss() const {
+		return peakBuildRss;
+	}
+	size_t NumTables() const override {
 		return trees.size();
 	}
 	size_t NumGoodTrees() const {
-		return goodTrees;
+		return std::count(badTree.begin(), badTree.end(), false);
 	}
 	size_t NumBadTrees() const {
-		return badTrees;
+		return std::count(badTree.begin(), badTree.end(), true);
+	}
+	// Share of the trees that the priority check would let a packet enter but the prefilters reject
+	double PrefilterRejectRate(const std::vector<Packet>& packets) const;
+	bool HasPrefilters() const {
+		return !filters.empty();
+	}
+	// Rules handled by the bit vector engine instead of bad trees
+	size_t NumBitVectorRules() const {
+		return bitVector ? bitVector->NumRules() : 0;
+	}
+	// With MemBudget, the cap and the builders' running estimate of the trees, filters and class tables
+	const MemoryBudget& Budget() const {
+		return budget;
+	}
+	bool HasBudget() const {
+		return budget.Limit() > 0;
+	}
+	// Rules sent to the bit vector engine because the budget ran out before a tree could take them
+	// The engine's tables count towards the estimate, from the moment its rules are known
+	size_t NumOverBudgetRules() const {
+		return overBudgetRules;
+	}
+	// With BC.MaxTrees, BC.MaxAccesses or BC.MaxDepth, construction keeps each lookup within the limits it can meet
+	bool HasLookupBounds() const {
+		return maxTrees > 0 || maxAccesses > 0 || maxDepth > 0;
+	}
+	size_t TreeLimit() const {
+		return maxTrees;
 	}
-	size_t RulesInTable(size_t tableIndex) const {
+	size_t AccessLimit() const {
+		return maxAccesses;
+	}
+	int DepthLimit() const {
+		return maxDepth;
+	}
+	// Trees whose rules were moved to the bit vector engine to meet the lookup bounds
+	size_t NumMergedTrees() const {
+		return mergedTrees;
+	}
+	// Guaranteed per-packet worst case: structures searched (trees and the bit vector engine) and cache lines touched
+	size_t WorstCaseTrees() const {
+		return trees.size() + (bitVector ? 1 : 0);
+	}
+	size_t WorstCaseLines() const;
+	// Port and protocol class tables in front of the trees, or null
+	const PortClasses* Classes() const {
+		return portClasses;
+	}
+	size_t RulesInTable(size_t tableIndex) const override {
 		return sizes[tableIndex];
 	}
 	size_t PriorityOfTable(size_t tableIndex) const {
 		return priorities[tableIndex];
 	}
 	
-	int HeightOfTree(size_t tableIndex) const {
-		return trees[tableIndex]->Height();
-	}
-	int CostOfTree(size_t tableIndex) const {
-		return trees[tableIndex]->Cost();
+	// Most cache lines one lookup can touch in a tree, its prefilter included
+	size_t LinesOfTree(size_t tableIndex) const {
+		return TreeLines(tableIndex, false);
 	}
 private:
 	bool IsWideAddress(Interval s) const;
-	void BuildTree(const std::vector<Rule>& rules);
-	void BuildBadTree(const std::vector<Rule>& rules);
-	std::vector<Rule> Separate(const std::vector<Rule>& rules, std::vector<Rule>& remain);
+	void ConfigureBuilder(TreeBuilder& bc);
+	// Every setting the args constructor reads, for copies made from built trees
+	void CopyConfiguration(const ByteCutsClassifier& other);
+	void AddTree(ByteCutsNode* tree, const std::vector<RuleIndex>& rules, const std::vector<RuleIndex>& remain, bool bad);
+	bool MayMatch(size_t tree, const Packet& p) const {
+		return filters.empty() || filters[tree].MayMatch(p);
+	}
+	bool OverBudget() const {
+		return HasBudget() && budget.Exhausted() && !trees.empty();
+	}
+	// Builds the good and bad trees for rules and returns the ones left for the bit vector engine
+	std::vector<RuleIndex> BuildForest(std::vector<RuleIndex> rules);
+	void BuildTree(const std::vector<RuleIndex>& rules, std::vector<RuleIndex>& overflow);
+	void BuildBadTree(const std::vector<RuleIndex>& rules, std::vector<RuleIndex>& overflow);
+	void BuildBitVector(const std::vector<RuleIndex>& rules);
+	size_t TreeLines(size_t tree, bool frozen) const;
+	// Lines a lookup can touch outside the trees: the forest's own arrays, the class tables and the bit vector
+	size_t ForestLines(size_t numTrees, size_t treeLines, size_t vectorLines) const;
+	size_t VectorLines(const std::vector<RuleIndex>& rules) const;
+	// Replaces the budget's charge for the bit vector engine with an estimate of its tables over rules
+	void ReserveBitVector(const std::vector<RuleIndex>& rules);
+	// Moves trees' rules to the bit vector engine until the lookup bounds hold or no move helps
+	void EnforceBounds(std::vector<RuleIndex>& vectorRules);
+	void RemoveTree(size_t tree);
+	const std::vector<Rule>& TreeRules() const {
+		return portClasses ? treeRules : rules;
+	}
+	void LoadTraffic();
+	void Freeze();
+	void Thaw();
+	int ClassifyInLockstep(const Packet& p) const;
+	void OrderTreesByTraffic();
+	std::vector<RuleIndex> Separate(const std::vector<RuleIndex>& rules, std::vector<RuleIndex>& remain);
+	int MaxPriority(const std::vector<RuleIndex>& rules) const;
 
+	// Priority-sorted rule store that tree construction indexes into
 	std::vector<Rule> rules;
 	std::vector<ByteCutsNode*> trees;
 	std::vector<int> priorities;
@@ -81,8 +214,55 @@ private:
 	double dredgeFraction;
 	double turningPoint;
 	double minFrac;
-	size_t goodTrees = 0;
-	size_t badTrees = 0;
+	size_t leafSize;
+	uint8_t maxDelta;
+	int primaryPenalty;
+	int secondaryPenalty;
+	bool compressCuts;
+	std::string badEngine;
+	// What cut selection minimises: worst-case child rules ("Rules") or estimated cache lines per lookup ("Cache")
+	std::string costModel;
+	// Trees descended together per packet; 1 visits them one after another
+	size_t lockstep = 1;
+	bool usePortClasses;
+	bool usePrefilter;
+	std::string hugePages = "Off";
+	
+	std::string trafficFile;
+	size_t trafficSample;
+	size_t coldLeafSize;
+	std::vector<Packet> traffic;
+	
+	// With BC.PortClasses, trees are built over treeRules, whose port and protocol ranges are class IDs
+	PortClasses* portClasses = nullptr;
+	std::vector<Rule> treeRules;
+	
+	// With HugePages=Auto or Transparent, constructed trees are copied here and the heap copies freed
+	HugePageArena* treeArena = nullptr;
+	
+	// With BC.Prefilter, a quick-reject test per tree, checked before descending it
+	std::vector<TreeFilter> filters;
+	
+	// Replaces the bad trees when BC.BadEngine=BitVector, and takes the rules left once MemBudget is spent
+	BitVectorClassifier* bitVector = nullptr;
+	
+	// With MemBudget set, builders narrow cuts and grow leaves as the estimate nears the cap, and stop adding trees past it
+	MemoryBudget budget{0};
+	size_t overBudgetRules = 0;
+	// Bytes of the bit vector engine currently charged to the budget
+	Memory vectorBytes = 0;
+	
+	// Lookup bounds, 0 for none: structures searched, cache lines touched, and levels per tree
+	size_t maxTrees;
+	size_t maxAccesses;
+	int maxDepth;
+	// While bounds are enforced, the rules each tree holds, so that a merged tree's rules can move
+	std::vector<std::vector<RuleIndex>> heldRules;
+	size_t mergedTrees = 0;
+	
+	Memory peakBuildRss = 0;
+	// Whether each tree was built from the rules Separate left over
+	std::vector<bool> badTree;
 };
 
 #endif
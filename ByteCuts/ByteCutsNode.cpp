@@ -23,29 +23,131 @@
  */
 #include "ByteCutsNode.h"
 
+#include "../Utilities/HugePages.h"
 #include "../Utilities/MapExtensions.h"
 
+#include <array>
 #include <limits>
+#include <new>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <unordered_map>
 #include <unordered_set>
 
 using namespace std;
 
-#define MaxDelta 16
-
 //************
 // ByteCutsNode
 //************
 
-void ByteCutsNode::LeafNode(ByteCutsNode& self, const vector<Rule>& rules) {
+void ByteCutsNode::LeafNode(ByteCutsNode& self, const vector<Rule>& rules, const Interval* region) {
 	self.mode = Leaf;
 	self.numRules = rules.size();
 	self.rules = new Rule[rules.size()];
 	for (size_t i = 0; i < rules.size(); i++) {
 		self.rules[i] = rules[i];
 	}
-	
+	self.ChooseMatcher(region);
+}
+
+void ByteCutsNode::LeafNode(ByteCutsNode& self, const vector<Rule>& store, const RuleIndex* indices, size_t numRules, const Interval* region) {
+	self.mode = Leaf;
+	self.numRules = numRules;
+	self.rules = new Rule[numRules];
+	for (size_t i = 0; i < numRules; i++) {
+		self.rules[i] = store[indices[i]];
+	}
+	self.ChooseMatcher(region);
+}
+
+enum FieldTest {
+	SkipField,
+	ExactField,
+	RangeField
+};
+
+static constexpr unsigned FieldOfDim(unsigned dim) {
+	return dim < FieldDA ? 0 : dim < FieldSP ? 1 : dim - FieldSP + 2;
+}
+
+// A matcher numbers its fields' tests in base 3, the first field lowest
+static constexpr unsigned TestOfField(unsigned matcher, unsigned field) {
+	return field == 0 ? matcher % 3 : TestOfField(matcher / 3, field - 1);
+}
+
+// Compares the dimensions from Dim on, with each field's test fixed at compile time
+template <unsigned Matcher, unsigned Dim>
+struct FieldMatch {
+	static bool Matches(const Rule& r, const Packet p) {
+		constexpr unsigned test = TestOfField(Matcher, FieldOfDim(Dim));
+		if (test == ExactField && p[Dim] != r.range[Dim].low) return false;
+		if (test == RangeField && (p[Dim] < r.range[Dim].low || p[Dim] > r.range[Dim].high)) return false;
+		return FieldMatch<Matcher, Dim + 1>::Matches(r, p);
+	}
+};
+
+template <unsigned Matcher>
+struct FieldMatch<Matcher, NumDims> {
+	static bool Matches(const Rule&, const Packet) {
+		return true;
+	}
+};
+
+template <unsigned Matcher>
+static int FirstMatch(const Rule* rules, size_t numRules, const Packet p) {
+	for (size_t i = 0; i < numRules; i++) {
+		if (FieldMatch<Matcher, 0>::Matches(rules[i], p)) {
+			return rules[i].priority;
+		}
+	}
+	return -1;
+}
+
+template <unsigned Matcher>
+static void AllMatches(const Rule* rules, size_t numRules, const Packet p, MatchBuffer& matches) {
+	for (size_t i = 0; i < numRules; i++) {
+		const Rule& r = rules[i];
+		if (r.priority > matches.Floor() && FieldMatch<Matcher, 0>::Matches(r, p)) {
+			matches.Add(r.priority);
+		}
+	}
 }
+
+typedef int (*FirstMatchKernel)(const Rule*, size_t, const Packet);
+typedef void (*AllMatchesKernel)(const Rule*, size_t, const Packet, MatchBuffer&);
+
+template <size_t... Matchers>
+static array<FirstMatchKernel, NumMatchers> FirstMatchKernels(index_sequence<Matchers...>) {
+	return {{&FirstMatch<Matchers>...}};
+}
+
+template <size_t... Matchers>
+static array<AllMatchesKernel, NumMatchers> AllMatchesKernels(index_sequence<Matchers...>) {
+	return {{&AllMatches<Matchers>...}};
+}
+
+static const array<FirstMatchKernel, NumMatchers> firstMatchKernels = FirstMatchKernels(make_index_sequence<NumMatchers>());
+static const array<AllMatchesKernel, NumMatchers> allMatchesKernels = AllMatchesKernels(make_index_sequence<NumMatchers>());
+
+void ByteCutsNode::ChooseMatcher(const Interval* region) {
+	unsigned code = 0;
+	for (unsigned f = NumFields; f-- > 0;) {
+		bool covered = true, exact = true;
+		for (unsigned d = 0; d < NumDims; d++) {
+			if (FieldOfDim(d) != f) continue;
+			Point low = region ? region[d].low : 0;
+			Point high = region ? region[d].high : HeaderMax(d);
+			for (size_t i = 0; i < numRules; i++) {
+				covered = covered && rules[i].range[d].low <= low && rules[i].range[d].high >= high;
+				exact = exact && rules[i].range[d].low == rules[i].range[d].high;
+			}
+		}
+		code = 3 * code + (covered ? SkipField : exact ? ExactField : RangeField);
+	}
+	matcher = code;
+}
+
 void ByteCutsNode::SplitNode(ByteCutsNode& self, uint8_t dim, uint16_t point, ByteCutsNode* left, ByteCutsNode* right) {
 	self.mode = Split;
 	self.dim = dim;
@@ -55,12 +157,65 @@ void ByteCutsNode::SplitNode(ByteCutsNode& self, uint8_t dim, uint16_t point, By
 	self.children[1] = right;
 }
 
-void ByteCutsNode::CutNode(ByteCutsNode& self, uint8_t dim, uint8_t left, uint8_t right, ByteCutsNode** children) {
+void ByteCutsNode::CutNode(ByteCutsNode& self, uint8_t dim, uint8_t left, uint8_t right, ByteCutsNode** children, bool compress) {
 	self.mode = Cut;
 	self.dim = dim;
 	self.cutInfo.cutLow = right;
 	self.cutInfo.cutTotal = left + right;
 	self.children = children;
+	if (compress) {
+		self.Compress();
+	}
+}
+
+void ByteCutsNode::Compress() {
+	// Shared children from the composer form runs of identical pointers
+	size_t numChildren = NumChildren();
+	size_t numRuns = 1;
+	for (size_t i = 1; i < numChildren; i++) {
+		if (children[i] != children[i - 1]) numRuns++;
+	}
+	
+	size_t words = BitmapWords();
+	size_t plainWords = numChildren;
+	size_t runWords = 1 + (numRuns + 1) / 2 + numRuns;
+	size_t bitmapWords = words + (words + 1) / 2 + numRuns;
+	
+	ByteCutsNode** plain = children;
+	if (numRuns <= MaxRunSearch && runWords < plainWords) {
+		mode = CutRuns;
+		packed = new uint64_t[runWords]();
+		packed[0] = numRuns;
+		uint32_t* starts = reinterpret_cast<uint32_t*>(packed + 1);
+		ByteCutsNode** kids = reinterpret_cast<ByteCutsNode**>(packed + 1 + (numRuns + 1) / 2);
+		size_t run = 0;
+		for (size_t i = 0; i < numChildren; i++) {
+			if (i == 0 || plain[i] != plain[i - 1]) {
+				starts[run] = i;
+				kids[run] = plain[i];
+				run++;
+			}
+		}
+	} else if (2 * bitmapWords <= plainWords) {
+		mode = CutBitmap;
+		packed = new uint64_t[bitmapWords]();
+		uint32_t* ranks = reinterpret_cast<uint32_t*>(packed + words);
+		ByteCutsNode** kids = reinterpret_cast<ByteCutsNode**>(packed + words + (words + 1) / 2);
+		size_t run = 0;
+		for (size_t i = 0; i < numChildren; i++) {
+			if (i % 64 == 0) {
+				ranks[i / 64] = run;
+			}
+			if (i == 0 || plain[i] != plain[i - 1]) {
+				packed[i / 64] |= 1ull << (i % 64);
+				kids[run] = plain[i];
+				run++;
+			}
+		}
+	} else {
+		return;
+	}
+	delete [] plain;
 }
 
 ByteCutsNode::ByteCutsNode() {
@@ -70,17 +225,19 @@ ByteCutsNode::ByteCutsNode() {
 ByteCutsNode::~ByteCutsNode() {
 	if (mode == Leaf) {
 		delete [] rules;
-	} else if (mode == Cut) {
-		size_t numChildren = NumChildren();
+	} else if (IsCut()) {
+		size_t numSlots;
+		ByteCutsNode* const* slots = ChildSlots(numSlots);
 		
-		unordered_set<ByteCutsNode*> uniqueChildren;
-		for (size_t i = 0; i < numChildren; i++) {
-			uniqueChildren.insert(children[i]);
-		}
+		unordered_set<ByteCutsNode*> uniqueChildren(slots, slots + numSlots);
 		for (auto c : uniqueChildren) {
 			delete c;
 		}
-		delete [] children;
+		if (mode == Cut) {
+			delete [] children;
+		} else {
+			delete [] packed;
+		}
 	} else {
 		delete children[0];
 		delete children[1];
@@ -88,10 +245,85 @@ ByteCutsNode::~ByteCutsNode() {
 	}
 }
 
+// Allocates nodes and arrays on the heap, to be released by the destructor
+struct HeapAllocator {
+	static const bool InArena = false;
+	ByteCutsNode* Node() { return new ByteCutsNode(); }
+	template <class T>
+	T* Array(size_t n) { return new T[n]; }
+};
+
+// Allocates nodes and arrays from an arena that outlives the tree
+struct ArenaAllocator {
+	static const bool InArena = true;
+	HugePageArena& arena;
+	ByteCutsNode* Node() { return new (arena.Allocate<ByteCutsNode>(1)) ByteCutsNode(); }
+	template <class T>
+	T* Array(size_t n) { return arena.Allocate<T>(n); }
+};
+
+template <class Allocator>
+ByteCutsNode* ByteCutsNode::CloneWith(Allocator& alloc) const {
+	ByteCutsNode* copy = alloc.Node();
+	*copy = *this;
+	copy->inArena = Allocator::InArena;
+	switch (mode) {
+		case Leaf:
+			copy->rules = alloc.template Array<Rule>(numRules);
+			copy_n(rules, numRules, copy->rules);
+			break;
+		case Split:
+			copy->children = alloc.template Array<ByteCutsNode*>(2);
+			copy->children[0] = children[0]->CloneWith(alloc);
+			copy->children[1] = children[1]->CloneWith(alloc);
+			break;
+		case Cut:
+		case CutRuns:
+		case CutBitmap:
+			{
+				size_t numSlots;
+				ByteCutsNode* const* slots = ChildSlots(numSlots);
+				ByteCutsNode** copySlots;
+				if (mode == Cut) {
+					copy->children = alloc.template Array<ByteCutsNode*>(numSlots);
+					copySlots = copy->children;
+				} else {
+					size_t words = PackedWords();
+					copy->packed = alloc.template Array<uint64_t>(words);
+					copy_n(packed, words, copy->packed);
+					copySlots = const_cast<ByteCutsNode**>(copy->RunChildren());
+				}
+				unordered_map<const ByteCutsNode*, ByteCutsNode*> clones;
+				for (size_t i = 0; i < numSlots; i++) {
+					auto it = clones.find(slots[i]);
+					if (it == clones.end()) {
+						it = clones.emplace(slots[i], slots[i]->CloneWith(alloc)).first;
+					}
+					copySlots[i] = it->second;
+				}
+			}
+			break;
+	}
+	return copy;
+}
+
+ByteCutsNode* ByteCutsNode::Clone() const {
+	HeapAllocator alloc;
+	return CloneWith(alloc);
+}
+
+ByteCutsNode* ByteCutsNode::CloneInto(HugePageArena& arena) const {
+	ArenaAllocator alloc{arena};
+	return CloneWith(alloc);
+}
+
 int ByteCutsNode::ClassifyAPacket(const Packet& p) const {
 	switch (mode) {
 		case Cut:
 			return children[IndexPacket(p)]->ClassifyAPacket(p);
+		case CutRuns:
+		case CutBitmap:
+			return Child(IndexPacket(p))->ClassifyAPacket(p);
 		case Split:
 			if (p[dim] <= splitPoint) {
 				return children[0]->ClassifyAPacket(p);
@@ -99,87 +331,239 @@ int ByteCutsNode::ClassifyAPacket(const Packet& p) const {
 				return children[1]->ClassifyAPacket(p);
 			}
 		case Leaf:
-			for (uint16_t i = 0; i < numRules; i++) {
-				if (rules[i].MatchesPacket(p)) {
-					return rules[i].priority;
-				}
-			}
-			return -1;
-			break;
+			return firstMatchKernels[matcher](rules, numRules, p);
+	}
+	return -1;
+}
+
+void ByteCutsNode::ClassifyAllMatches(const Packet& p, MatchBuffer& matches) const {
+	// A packet reaches exactly one leaf of a tree
+	const ByteCutsNode* node = this;
+	while (node->mode != Leaf) {
+		if (node->mode == Split) {
+			node = node->children[p[node->dim] <= node->splitPoint ? 0 : 1];
+		} else {
+			node = node->Child(node->IndexPacket(p));
+		}
 	}
+	allMatchesKernels[node->matcher](node->rules, node->numRules, p, matches);
 }
 
-int ByteCutsNode::Size(int ruleSize) const {
-	int result = NodeSize;
+// Bytes the allocator actually reserved for a block, including its chunk header
+// Arena blocks carry no header and are exactly the requested size
+static Memory AllocatedBytes(const void* p, size_t requested, bool inArena) {
+#ifdef __GLIBC__
+	if (inArena) return requested;
+	return malloc_usable_size(const_cast<void*>(p)) + sizeof(size_t);
+#else
+	return requested;
+#endif
+}
+
+void TreeStats::Add(const TreeStats& other) {
+	nodeBytes += other.nodeBytes;
+	cutArrayBytes += other.cutArrayBytes;
+	splitArrayBytes += other.splitArrayBytes;
+	leafRuleBytes += other.leafRuleBytes;
+	sharedSlotBytes += other.sharedSlotBytes;
+	bitVectorBytes += other.bitVectorBytes;
+	classTableBytes += other.classTableBytes;
+	filterBytes += other.filterBytes;
+	cutNodes += other.cutNodes;
+	compressedCutNodes += other.compressedCutNodes;
+	splitNodes += other.splitNodes;
+	leafNodes += other.leafNodes;
+	uniqueChildren += other.uniqueChildren;
+	sharedChildren += other.sharedChildren;
+	height = max(height, other.height);
+	cost = max(cost, other.cost);
+	cacheLines = max(cacheLines, other.cacheLines);
+	leafFieldTests += other.leafFieldTests;
+	skippedFieldTests += other.skippedFieldTests;
+	exactFieldTests += other.exactFieldTests;
+}
+
+TreeStats ByteCutsNode::Stats() const {
+	TreeStats stats;
+	Account(stats, stats.height, stats.cost, stats.cacheLines);
+	return stats;
+}
+
+void ByteCutsNode::Account(TreeStats& stats, int& height, int& cost, int& lines) const {
+	stats.nodeBytes += AllocatedBytes(this, sizeof(ByteCutsNode), inArena);
 	switch (mode) {
 		case Cut:
+		case CutRuns:
+		case CutBitmap:
 			{
-				size_t numChildren = NumChildren();
-				unordered_set<ByteCutsNode*> uchildren(children, children + numChildren);
-				for (ByteCutsNode* child : uchildren) {
-					result += child->Size(ruleSize);
+				size_t numChildren;
+				ByteCutsNode* const* slots = ChildSlots(numChildren);
+				stats.cutNodes++;
+				int slotLines;
+				if (mode == Cut) {
+					stats.cutArrayBytes += AllocatedBytes(children, numChildren * sizeof(ByteCutsNode*), inArena);
+					slotLines = SlotLines(numChildren * sizeof(ByteCutsNode*));
+				} else {
+					stats.compressedCutNodes++;
+					stats.cutArrayBytes += AllocatedBytes(packed, PackedWords() * sizeof(uint64_t), inArena);
+					// Run starts are binary searched; a bitmap reads a word, its rank and the child slot
+					size_t packedLines = LinesOf(PackedWords() * sizeof(uint64_t));
+					if (packedLines == 1) {
+						slotLines = 1;
+					} else if (mode == CutRuns) {
+						slotLines = 1 + (64 - __builtin_clzll(LinesOf(NumRuns() * sizeof(uint32_t))));
+					} else {
+						slotLines = 3;
+					}
+				}
+				
+				vector<ByteCutsNode*> uchildren(slots, slots + numChildren);
+				sort(uchildren.begin(), uchildren.end());
+				int maxHeight = 0, maxCost = 0, maxLines = 0;
+				for (size_t i = 0; i < numChildren;) {
+					size_t j = i;
+					while (j < numChildren && uchildren[j] == uchildren[i]) j++;
+					if (j - i > 1) {
+						stats.sharedChildren++;
+						stats.sharedSlotBytes += (j - i - 1) * sizeof(ByteCutsNode*);
+					} else {
+						stats.uniqueChildren++;
+					}
+					int h, c, l;
+					uchildren[i]->Account(stats, h, c, l);
+					maxHeight = max(maxHeight, h);
+					maxCost = max(maxCost, c);
+					maxLines = max(maxLines, l);
+					i = j;
 				}
+				height = maxHeight + 1;
+				cost = maxCost + 1;
+				lines = 1 + slotLines + maxLines;
 			}
 			break;
 		case Split:
-			result += children[0]->Size(ruleSize);
-			result += children[1]->Size(ruleSize);
+			{
+				stats.splitNodes++;
+				stats.splitArrayBytes += AllocatedBytes(children, 2 * sizeof(ByteCutsNode*), inArena);
+				int hl, cl, ll, hr, cr, lr;
+				children[0]->Account(stats, hl, cl, ll);
+				children[1]->Account(stats, hr, cr, lr);
+				height = max(hl, hr) + 1;
+				cost = max(cl, cr) + 1;
+				lines = 1 + SlotLines(2 * sizeof(ByteCutsNode*)) + max(ll, lr);
+			}
 			break;
 		case Leaf:
-			result += numRules * ruleSize;
+			stats.leafNodes++;
+			stats.leafRuleBytes += AllocatedBytes(rules, numRules * sizeof(Rule), inArena);
+			stats.leafFieldTests += NumFields * numRules;
+			for (unsigned f = 0; f < NumFields; f++) {
+				unsigned test = TestOfField(matcher, f);
+				stats.skippedFieldTests += (test == SkipField) ? numRules : 0;
+				stats.exactFieldTests += (test == ExactField) ? numRules : 0;
+			}
+			height = 1;
+			cost = numRules;
+			lines = 1 + LinesOf(numRules * sizeof(Rule));
 			break;
 	}
-	return result;
-	
 }
 
-int ByteCutsNode::Height() const {
+Memory ByteCutsNode::OwnBytes() const {
+	Memory bytes = AllocatedBytes(this, sizeof(ByteCutsNode), inArena);
 	switch (mode) {
 		case Cut:
-			{
-				size_t numChildren = NumChildren();
-				int maxHeight = 0;
-				unordered_set<ByteCutsNode*> uchildren(children, children + numChildren);
-				for (ByteCutsNode* child : uchildren) {
-					maxHeight = max(maxHeight, child->Height());
-				}
-				return maxHeight + 1;
-			}
-			break;
+			return bytes + AllocatedBytes(children, NumChildren() * sizeof(ByteCutsNode*), inArena);
+		case CutRuns:
+		case CutBitmap:
+			return bytes + AllocatedBytes(packed, PackedWords() * sizeof(uint64_t), inArena);
 		case Split:
-			return max(children[0]->Height(), children[1]->Height()) + 1;
-			break;
+			return bytes + AllocatedBytes(children, 2 * sizeof(ByteCutsNode*), inArena);
 		case Leaf:
-			return 1;
-			break;
+			return bytes + AllocatedBytes(rules, numRules * sizeof(Rule), inArena);
 	}
+	return bytes;
 }
 
-int ByteCutsNode::Cost() const {
+int ByteCutsNode::WorstCaseLines(bool frozen) const {
+	bool heap = !inArena && !frozen;
+	int lines = BlockLines(sizeof(ByteCutsNode), alignof(ByteCutsNode), heap);
 	switch (mode) {
 		case Cut:
+		case CutRuns:
+		case CutBitmap:
 			{
-				size_t numChildren = NumChildren();
-				int maxHeight = 0;
-				unordered_set<ByteCutsNode*> uchildren(children, children + numChildren);
-				for (ByteCutsNode* child : uchildren) {
-					maxHeight = max(maxHeight, child->Cost());
+				size_t numSlots;
+				ByteCutsNode* const* slots = ChildSlots(numSlots);
+				if (mode == Cut) {
+					// One aligned pointer
+					lines += 1;
+				} else if (mode == CutRuns) {
+					// The run starts are searched and at most MaxRunSearch long, so count the whole block
+					lines += BlockLines(PackedWords() * sizeof(uint64_t), alignof(uint64_t), heap);
+				} else {
+					// The bitmap word, its rank and the child pointer
+					lines += 3;
 				}
-				return maxHeight + 1;
+				vector<ByteCutsNode*> uchildren(slots, slots + numSlots);
+				sort(uchildren.begin(), uchildren.end());
+				uchildren.erase(unique(uchildren.begin(), uchildren.end()), uchildren.end());
+				int worst = 0;
+				for (ByteCutsNode* c : uchildren) {
+					worst = max(worst, c->WorstCaseLines(frozen));
+				}
+				return lines + worst;
 			}
-			break;
 		case Split:
-			return max(children[0]->Height(), children[1]->Cost()) + 1;
-			break;
+			lines += BlockLines(2 * sizeof(ByteCutsNode*), alignof(ByteCutsNode*), heap);
+			return lines + max(children[0]->WorstCaseLines(frozen), children[1]->WorstCaseLines(frozen));
 		case Leaf:
-			return numRules;
-			break;
+			return lines + BlockLines(numRules * sizeof(Rule), alignof(Rule), heap);
 	}
+	return lines;
 }
 
-size_t ByteCutsNode::IndexPacket(const Packet& p) const {
-	Point pt = p[dim];
-	Point mask = 0xFFFFFFFFu >> (cutInfo.cutTotal);
-	return (pt >> cutInfo.cutLow) & mask;
+void ByteCutsNode::CollectPriorities(vector<int>& out) const {
+	if (mode == Leaf) {
+		for (size_t i = 0; i < numRules; i++) {
+			out.push_back(rules[i].priority);
+		}
+	} else if (IsCut()) {
+		size_t numSlots;
+		ByteCutsNode* const* slots = ChildSlots(numSlots);
+		unordered_set<ByteCutsNode*> uniqueChildren(slots, slots + numSlots);
+		for (auto c : uniqueChildren) {
+			c->CollectPriorities(out);
+		}
+	} else {
+		children[0]->CollectPriorities(out);
+		children[1]->CollectPriorities(out);
+	}
+}
+
+void ByteCutsNode::Renumber(const vector<int>& renumbered) {
+	if (mode == Leaf) {
+		// The array keeps its size; only the count shrinks
+		size_t kept = 0;
+		for (size_t i = 0; i < numRules; i++) {
+			int priority = renumbered[rules[i].priority];
+			if (priority >= 0) {
+				rules[kept] = rules[i];
+				rules[kept++].priority = priority;
+			}
+		}
+		numRules = kept;
+	} else if (IsCut()) {
+		// Shared children are renumbered once
+		size_t numSlots;
+		ByteCutsNode* const* slots = ChildSlots(numSlots);
+		unordered_set<ByteCutsNode*> uniqueChildren(slots, slots + numSlots);
+		for (auto c : uniqueChildren) {
+			c->Renumber(renumbered);
+		}
+	} else {
+		children[0]->Renumber(renumbered);
+		children[1]->Renumber(renumbered);
+	}
 }
 
@@ -27,6 +27,7 @@
 
 #include "../Common.h"
 
+#include <cstddef>
 #include <functional>
 #include <unordered_map>
 #include <utility>
@@ -44,11 +45,108 @@
 #define ByteMin 0
 #define ByteMax 255
 
-#define NodeSize 8
-
 #define BitsPerField 32
 
+// Compressed cut nodes with at most this many runs use a binary search over run starts
+#define MaxRunSearch 8
+
+// Leaves test rules field by field: source and destination address (all their words), ports and protocol
+// Each field is skipped, compared for equality or compared as a range, giving 3^NumFields matchers
+#define NumFields 5
+#define NumMatchers 243
+
 typedef std::pair<uint32_t, uint32_t> SpanRange;
+typedef uint32_t RuleIndex;
+
+#define CacheLineBytes 64
+#define PageBytes 4096
+
+// Cache lines touched by scanning a block from its start
+inline size_t LinesOf(size_t bytes) {
+	return (bytes + CacheLineBytes - 1) / CacheLineBytes;
+}
+
+// Most cache lines a block can straddle when its allocator only guarantees the given alignment
+// Heap blocks are at least aligned for any fundamental type
+inline size_t BlockLines(size_t bytes, size_t align, bool heap = true) {
+	if (heap) align = std::max(align, alignof(std::max_align_t));
+	return LinesOf(bytes + CacheLineBytes - std::min<size_t>(align, CacheLineBytes));
+}
+
+// Estimated cache lines a lookup touches to pick a child of a node: the slot, plus a page walk
+// when the child array spans more than a page
+inline size_t SlotLines(size_t arrayBytes) {
+	return 1 + (arrayBytes > PageBytes ? 1 : 0);
+}
+
+// Actual allocated bytes of a tree, by category, gathered in one walk
+struct TreeStats {
+	Memory nodeBytes = 0;
+	Memory cutArrayBytes = 0;
+	Memory splitArrayBytes = 0;
+	Memory leafRuleBytes = 0;
+	// Pointer bytes in cut arrays that repeat a child already referenced
+	Memory sharedSlotBytes = 0;
+	// Tables of the bit vector engine, when it replaces the bad trees
+	Memory bitVectorBytes = 0;
+	// Port and protocol class tables shared by the trees
+	Memory classTableBytes = 0;
+	// Per-tree prefilters
+	Memory filterBytes = 0;
+	
+	size_t cutNodes = 0;
+	size_t compressedCutNodes = 0;
+	size_t splitNodes = 0;
+	size_t leafNodes = 0;
+	size_t uniqueChildren = 0;
+	size_t sharedChildren = 0;
+	
+	int height = 0;
+	int cost = 0;
+	// Cache lines touched along the most expensive path, scanning every rule of its leaf
+	int cacheLines = 0;
+	
+	// Field tests of every leaf rule, and how many of them the leaves' matchers skip or reduce to one compare
+	size_t leafFieldTests = 0;
+	size_t skippedFieldTests = 0;
+	size_t exactFieldTests = 0;
+	
+	Memory TotalBytes() const {
+		return nodeBytes + cutArrayBytes + splitArrayBytes + leafRuleBytes + bitVectorBytes + classTableBytes + filterBytes;
+	}
+	void Add(const TreeStats& other);
+};
+
+// Caller-owned buffer of the highest-priority distinct matches for one packet
+struct MatchBuffer {
+	int* out;
+	size_t capacity;
+	size_t count = 0;
+	int floor = -1;
+
+	MatchBuffer(int* out, size_t capacity) : out(out), capacity(capacity) {}
+
+	// Lowest priority that could still change the contents
+	int Floor() const {
+		return count < capacity ? -1 : floor;
+	}
+	void Add(int priority) {
+		if (capacity == 0 || priority <= Floor()) return;
+		for (size_t i = 0; i < count; i++) {
+			if (out[i] == priority) return;
+		}
+		if (count < capacity) {
+			out[count++] = priority;
+		} else {
+			*std::min_element(out, out + count) = priority;
+		}
+		if (count == capacity) {
+			floor = *std::min_element(out, out + count);
+		}
+	}
+};
+
+class HugePageArena;
 
 struct CutInfo {
 	uint8_t cutLow;
@@ -60,26 +158,125 @@ public:
 	enum BCMode : uint8_t {
 		Cut,
 		Split,
-		Leaf
+		Leaf,
+		// Cut nodes whose child array is stored compressed
+		CutRuns,
+		CutBitmap
 	};
 
-	static void LeafNode(ByteCutsNode& self, const std::vector<Rule>& rules);
+	// Region bounds, per dimension, the packets that can reach the leaf; without it, any packet can
+	static void LeafNode(ByteCutsNode& self, const std::vector<Rule>& rules, const Interval* region = nullptr);
+	static void LeafNode(ByteCutsNode& self, const std::vector<Rule>& store, const RuleIndex* indices, size_t numRules, const Interval* region = nullptr);
 	static void SplitNode(ByteCutsNode& self, uint8_t dim, uint16_t point, ByteCutsNode* left, ByteCutsNode* right);
-	static void CutNode(ByteCutsNode& self, uint8_t dim, uint8_t left, uint8_t right, ByteCutsNode** children);
+	static void CutNode(ByteCutsNode& self, uint8_t dim, uint8_t left, uint8_t right, ByteCutsNode** children, bool compress = true);
 	
 	ByteCutsNode();
 	~ByteCutsNode();
 
+	// Deep copy that keeps children shared where the original shares them
+	ByteCutsNode* Clone() const;
+	// The same copy with every node and array placed in the arena; it is freed with the arena, never deleted
+	ByteCutsNode* CloneInto(HugePageArena& arena) const;
+
 	int ClassifyAPacket(const Packet& p) const;
-	int Size(int ruleSize) const;
+	void ClassifyAllMatches(const Packet& p, MatchBuffer& matches) const;
+	TreeStats Stats() const;
 	bool IsEmpty() const { return false; }
 	size_t NumChildren() const { return 0x1u << (BitsPerField - cutInfo.cutTotal); }
 
-	size_t IndexPacket(const Packet& p) const;
+	size_t IndexPacket(const Packet& p) const {
+		Point mask = 0xFFFFFFFFu >> (cutInfo.cutTotal);
+		return (p[dim] >> cutInfo.cutLow) & mask;
+	}
+	bool IsCut() const { return mode == Cut || mode == CutRuns || mode == CutBitmap; }
+	bool IsLeaf() const { return mode == Leaf; }
+	
+	// One level of descent: the child of a cut or split node that the packet falls into
+	const ByteCutsNode* Next(const Packet& p) const {
+		if (mode == Split) return children[p[dim] > splitPoint];
+		return Child(IndexPacket(p));
+	}
+	// Starts loading the rules of a leaf before they are scanned
+	void PrefetchRules() const {
+		__builtin_prefetch(rules);
+	}
+	
+	// Child of a cut node at the given index, whatever the child array representation
+	ByteCutsNode* Child(size_t index) const {
+		switch (mode) {
+			case CutRuns:
+				{
+					const uint32_t* starts = RunStarts();
+					size_t run = std::upper_bound(starts, starts + NumRuns(), index) - starts - 1;
+					return RunChildren()[run];
+				}
+			case CutBitmap:
+				{
+					const uint64_t* words = packed;
+					const uint32_t* ranks = BitmapRanks();
+					size_t w = index >> 6;
+					uint64_t below = words[w] & ((2ull << (index & 63)) - 1);
+					return RunChildren()[ranks[w] + __builtin_popcountll(below) - 1];
+				}
+			default:
+				return children[index];
+		}
+	}
 	
-	int Height() const;
-	int Cost() const;
+	// Bytes allocated for this node and the array it holds, not counting its children
+	Memory OwnBytes() const;
+	// Most cache lines any lookup can touch in this subtree, whatever the alignment of its blocks
+	// frozen counts the blocks as they will be laid out once copied into an arena
+	int WorstCaseLines(bool frozen = false) const;
+	// Priorities of the rules stored in this subtree's leaves; a rule in several leaves appears once per leaf
+	void CollectPriorities(std::vector<int>& out) const;
+	// Gives every leaf rule the priority renumbered[old priority], dropping those mapped to -1
+	// The mapping must keep the order of the rules it keeps, so each leaf stays first-match
+	void Renumber(const std::vector<int>& renumbered);
 private:
+	void Account(TreeStats& stats, int& height, int& cost, int& lines) const;
+	void Compress();
+	// Picks the leaf's matcher: a field is skipped when every rule covers it across the region,
+	// and compared for equality when every rule holds a single value in it
+	void ChooseMatcher(const Interval* region);
+	template <class Allocator>
+	ByteCutsNode* CloneWith(Allocator& alloc) const;
+	
+	// Compressed child arrays live in one block of 64-bit words:
+	// CutRuns:   [numRuns] [uint32_t run starts] [run children]
+	// CutBitmap: [run start bitmap] [uint32_t runs before each word] [run children]
+	size_t BitmapWords() const {
+		return (NumChildren() + 63) / 64;
+	}
+	size_t PackedWords() const {
+		if (mode == CutRuns) return 1 + (packed[0] + 1) / 2 + packed[0];
+		return BitmapWords() + (BitmapWords() + 1) / 2 + NumRuns();
+	}
+	size_t NumRuns() const {
+		if (mode == CutRuns) return packed[0];
+		size_t w = BitmapWords() - 1;
+		return BitmapRanks()[w] + __builtin_popcountll(packed[w]);
+	}
+	const uint32_t* RunStarts() const {
+		return reinterpret_cast<const uint32_t*>(packed + 1);
+	}
+	const uint32_t* BitmapRanks() const {
+		return reinterpret_cast<const uint32_t*>(packed + BitmapWords());
+	}
+	ByteCutsNode* const* RunChildren() const {
+		size_t offset = (mode == CutRuns) ? 1 + (packed[0] + 1) / 2 : BitmapWords() + (BitmapWords() + 1) / 2;
+		return reinterpret_cast<ByteCutsNode* const*>(packed + offset);
+	}
+	// Child pointers as stored, whatever the representation
+	ByteCutsNode* const* ChildSlots(size_t& numSlots) const {
+		if (mode == Cut) {
+			numSlots = NumChildren();
+			return children;
+		}
+		numSlots = NumRuns();
+		return RunChildren();
+	}
+
 	uint8_t CutLow() const {
 		return cutInfo.cutLow;
 	}
@@ -88,6 +285,8 @@ private:
 	}
 
 	BCMode mode;
+	// Set on copies placed in a HugePageArena, whose blocks the allocator cannot size
+	bool inArena = false;
 	union {
 		uint8_t dim;
 		uint8_t numRules;
@@ -95,10 +294,13 @@ private:
 	union {
 		CutInfo cutInfo;
 		uint16_t splitPoint;
+		// Leaves: which specialization of the rule scan to run, below NumMatchers
+		uint8_t matcher;
 	};
 	union {
 		ByteCutsNode** children;
 		Rule* rules;
+		uint64_t* packed;
 	};
 	
 };
@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "ClassifierHandle.h"
+
+using namespace std;
+
+ClassifierHandle::ClassifierHandle(ByteCutsClassifier* initial, size_t maxReaders) 
+	: current(initial), epoch(1), slots(new ReaderSlot[maxReaders]), maxReaders(maxReaders), numReaders(0) {
+	for (size_t i = 0; i < maxReaders; i++) {
+		slots[i].epoch.store(Idle);
+	}
+}
+
+ClassifierHandle::~ClassifierHandle() {
+	// Readers must have stopped by now
+	for (Retired& r : retired) {
+		delete r.classifier;
+	}
+	delete current.load();
+}
+
+size_t ClassifierHandle::RegisterReader() {
+	size_t reader = numReaders.fetch_add(1);
+	if (reader >= maxReaders) {
+		printf("Too many readers: %lu > %lu\n", reader + 1, maxReaders);
+		exit(1);
+	}
+	return reader;
+}
+
+int ClassifierHandle::ClassifyAPacket(size_t reader, const Packet& packet) const {
+	Enter(reader);
+	int result = current.load()->ClassifyAPacket(packet);
+	Exit(reader);
+	return result;
+}
+
+void ClassifierHandle::ClassifyPackets(size_t reader, const Packet* packets, size_t numPackets, int* results) const {
+	// One epoch announcement covers the whole batch
+	Enter(reader);
+	const ByteCutsClassifier* classifier = current.load();
+	for (size_t i = 0; i < numPackets; i++) {
+		results[i] = classifier->ClassifyAPacket(packets[i]);
+	}
+	Exit(reader);
+}
+
+void ClassifierHandle::Publish(ByteCutsClassifier* next) {
+	lock_guard<mutex> guard(writerLock);
+	ByteCutsClassifier* old = current.exchange(next);
+	// Readers announcing this epoch or later entered after the swap and cannot hold old
+	uint64_t retiredAt = epoch.fetch_add(1) + 1;
+	retired.push_back(Retired{old, retiredAt});
+	numPublished++;
+	ReclaimLocked();
+}
+
+void ClassifierHandle::Reclaim() {
+	lock_guard<mutex> guard(writerLock);
+	ReclaimLocked();
+}
+
+void ClassifierHandle::ReclaimLocked() {
+	uint64_t oldest = Idle;
+	size_t readers = min(numReaders.load(), maxReaders);
+	for (size_t i = 0; i < readers; i++) {
+		oldest = min(oldest, slots[i].epoch.load());
+	}
+	
+	size_t kept = 0;
+	for (Retired& r : retired) {
+		if (r.epoch <= oldest) {
+			delete r.classifier;
+			numReclaimed++;
+		} else {
+			retired[kept++] = r;
+		}
+	}
+	retired.resize(kept);
+}
+
+size_t ClassifierHandle::NumPending() const {
+	lock_guard<mutex> guard(writerLock);
+	return retired.size();
+}
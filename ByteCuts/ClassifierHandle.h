@@ -0,0 +1,88 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef ClassifierHandle_H
+#define ClassifierHandle_H
+
+#include "ByteCuts.h"
+
+#include <atomic>
+#include <mutex>
+
+// Shares a classifier between lock-free reader threads while replacements are published
+// Readers announce the epoch they entered in; a retired classifier is freed once
+// no reader remains in an epoch older than its retirement
+class ClassifierHandle {
+public:
+	ClassifierHandle(ByteCutsClassifier* initial, size_t maxReaders);
+	~ClassifierHandle();
+
+	// Each reader thread registers once and passes its id to every lookup
+	size_t RegisterReader();
+
+	int ClassifyAPacket(size_t reader, const Packet& packet) const;
+	void ClassifyPackets(size_t reader, const Packet* packets, size_t numPackets, int* results) const;
+
+	// Swaps in a classifier (taking ownership) and frees any retired ones that are now unreachable
+	void Publish(ByteCutsClassifier* next);
+	void Reclaim();
+
+	size_t NumPublished() const { return numPublished; }
+	size_t NumReclaimed() const { return numReclaimed; }
+	size_t NumPending() const;
+private:
+	static const uint64_t Idle = ~0ull;
+
+	// Padded so that readers do not share cache lines
+	struct ReaderSlot {
+		std::atomic<uint64_t> epoch;
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+	};
+	struct Retired {
+		ByteCutsClassifier* classifier;
+		uint64_t epoch;
+	};
+
+	void ReclaimLocked();
+
+	void Enter(size_t reader) const {
+		slots[reader].epoch.store(epoch.load());
+	}
+	void Exit(size_t reader) const {
+		slots[reader].epoch.store(Idle, std::memory_order_release);
+	}
+
+	std::atomic<ByteCutsClassifier*> current;
+	std::atomic<uint64_t> epoch;
+	std::unique_ptr<ReaderSlot[]> slots;
+	size_t maxReaders;
+	std::atomic<size_t> numReaders;
+
+	mutable std::mutex writerLock;
+	std::vector<Retired> retired;
+	size_t numPublished = 0;
+	size_t numReclaimed = 0;
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "NumaReplicas.h"
+
+#include <fstream>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+// Parses sysfs lists such as "0-3,8-11"
+static vector<int> ReadIdList(const string& filename) {
+	vector<int> ids;
+	ifstream in(filename);
+	string list;
+	if (!in.is_open() || !getline(in, list)) return ids;
+	size_t pos = 0;
+	while (pos < list.size()) {
+		size_t end = list.find(',', pos);
+		if (end == string::npos) end = list.size();
+		string part = list.substr(pos, end - pos);
+		size_t dash = part.find('-');
+		if (!part.empty()) {
+			int low = stoi(part.substr(0, dash));
+			int high = (dash == string::npos) ? low : stoi(part.substr(dash + 1));
+			for (int i = low; i <= high; i++) {
+				ids.push_back(i);
+			}
+		}
+		pos = end + 1;
+	}
+	return ids;
+}
+
+vector<int> NumaReplicas::OnlineNodes() {
+	vector<int> nodes = ReadIdList("/sys/devices/system/node/online");
+	if (nodes.empty()) nodes.push_back(0);
+	return nodes;
+}
+
+int NumaReplicas::CurrentNode() {
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+	return node;
+}
+
+NumaReplicas::NumaReplicas(const ByteCutsClassifier& master) : master(master), nodes(OnlineNodes()) {
+	if (nodes.size() < 2) return;
+	
+	for (int node : nodes) {
+		ByteCutsClassifier* replica = nullptr;
+		thread builder([&]() {
+			NodePin pin(node);
+			if (!pin.Pinned()) {
+				printf("Could not pin to node %d; its replica may be remote\n", node);
+			}
+			replica = master.Replicate();
+		});
+		builder.join();
+		replicas.push_back(replica);
+	}
+}
+
+NumaReplicas::~NumaReplicas() {
+	for (ByteCutsClassifier* r : replicas) {
+		delete r;
+	}
+}
+
+const ByteCutsClassifier& NumaReplicas::ForNode(int node) const {
+	for (size_t i = 0; i < replicas.size(); i++) {
+		if (nodes[i] == node) return *replicas[i];
+	}
+	return master;
+}
+
+NodePin::NodePin(int node) {
+	vector<int> cpus = ReadIdList("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+	if (cpus.empty()) return;
+	restore = sched_getaffinity(0, sizeof(saved), &saved) == 0;
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for (int cpu : cpus) {
+		CPU_SET(cpu, &mask);
+	}
+	pinned = sched_setaffinity(0, sizeof(mask), &mask) == 0;
+}
+
+NodePin::~NodePin() {
+	if (pinned && restore) {
+		sched_setaffinity(0, sizeof(saved), &saved);
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef NumaReplicas_H
+#define NumaReplicas_H
+
+#include "ByteCuts.h"
+
+#include <sched.h>
+
+// One copy of a constructed classifier per NUMA node, each allocated by a thread
+// pinned to that node so first-touch places its pages locally
+// On single-node machines the original classifier is used directly
+class NumaReplicas {
+public:
+	explicit NumaReplicas(const ByteCutsClassifier& master);
+	~NumaReplicas();
+
+	// Copy on the node the calling thread is running on
+	const ByteCutsClassifier& Local() const {
+		return ForNode(CurrentNode());
+	}
+	const ByteCutsClassifier& ForNode(int node) const;
+	// Node the i-th worker thread should run on, spreading workers over the nodes in turn
+	int NodeOfThread(size_t thread) const {
+		return nodes[thread % nodes.size()];
+	}
+
+	// Copies in use, counting the original when there is only one node
+	size_t NumReplicas() const { return replicas.empty() ? 1 : replicas.size(); }
+
+	static int CurrentNode();
+	static std::vector<int> OnlineNodes();
+private:
+	const ByteCutsClassifier& master;
+	std::vector<int> nodes;
+	std::vector<ByteCutsClassifier*> replicas;
+};
+
+// Keeps the calling thread on one node's CPUs while in scope, then restores its previous affinity
+// A thread that is not pinned may migrate, and Local() then stops meaning local
+class NodePin {
+public:
+	explicit NodePin(int node);
+	~NodePin();
+	NodePin(const NodePin&) = delete;
+	NodePin& operator=(const NodePin&) = delete;
+
+	bool Pinned() const { return pinned; }
+private:
+	cpu_set_t saved;
+	bool restore = false;
+	bool pinned = false;
+};
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "PortClasses.h"
+
+#include <limits>
+
+using namespace std;
+
+PortClasses::PortClasses(const vector<Rule>& rules) {
+	const pair<uint8_t, size_t> domains[] = { {FieldSP, 1u << 16}, {FieldDP, 1u << 16}, {FieldProto, 1u << 8} };
+	for (auto domain : domains) {
+		uint8_t dim = domain.first;
+		size_t size = domain.second;
+		
+		// Values past the table share one class, which is only exact if no rule ends between them
+		bool fits = all_of(rules.begin(), rules.end(), [=](const Rule& r) {
+			return r.range[dim].low < size && (r.range[dim].high < size || r.range[dim].high == numeric_limits<Point>::max());
+		});
+		if (!fits) continue;
+		
+		vector<bool> starts(size, false);
+		starts[0] = true;
+		for (const Rule& r : rules) {
+			starts[r.range[dim].low] = true;
+			if (r.range[dim].high + 1 < size) {
+				starts[r.range[dim].high + 1] = true;
+			}
+		}
+		ClassTable t;
+		t.dim = dim;
+		t.classes.resize(size);
+		int id = -1;
+		for (size_t x = 0; x < size; x++) {
+			if (starts[x]) id++;
+			t.classes[x] = id;
+		}
+		t.beyond = id + 1;
+		tables.push_back(t);
+	}
+}
+
+Rule PortClasses::Translate(const Rule& r) const {
+	Rule translated = r;
+	for (const ClassTable& t : tables) {
+		translated.range[t.dim].low = t.Lookup(r.range[t.dim].low);
+		translated.range[t.dim].high = t.Lookup(r.range[t.dim].high);
+	}
+	return translated;
+}
+
+size_t PortClasses::WorstCaseLines() const {
+	return BlockLines(tables.size() * sizeof(ClassTable), alignof(ClassTable)) + tables.size();
+}
+
+Memory PortClasses::MemSizeBytes() const {
+	Memory total = 0;
+	for (const ClassTable& t : tables) {
+		total += t.classes.size() * sizeof(uint16_t);
+	}
+	return total;
+}
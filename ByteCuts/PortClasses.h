@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef PortClasses_H
+#define PortClasses_H
+
+#include "ByteCutsNode.h"
+
+// Maps port and protocol values to equivalence classes through direct tables, as in the first phase of RFC
+// A class is an elementary interval between rule boundaries, numbered in value order,
+// so every rule range becomes a contiguous range of class IDs that trees can cut and split
+class PortClasses {
+public:
+	PortClasses(const std::vector<Rule>& rules);
+
+	// Writes the packet with its port and protocol values replaced by class IDs into out
+	Packet Translate(const Packet p, Point* out) const {
+		std::copy_n(p, NumDims, out);
+		for (const ClassTable& t : tables) {
+			out[t.dim] = t.Lookup(p[t.dim]);
+		}
+		return out;
+	}
+	Rule Translate(const Rule& r) const;
+
+	size_t NumTables() const { return tables.size(); }
+	uint8_t DimOfTable(size_t i) const { return tables[i].dim; }
+	size_t NumClasses(size_t i) const { return tables[i].beyond; }
+	Memory MemSizeBytes() const;
+	// Most cache lines one translation can touch: each table's header and one entry
+	size_t WorstCaseLines() const;
+private:
+	struct ClassTable {
+		uint8_t dim;
+		std::vector<uint16_t> classes;
+		// Class shared by every value past the end of the table
+		Point beyond;
+
+		Point Lookup(Point x) const {
+			return x < classes.size() ? classes[x] : beyond;
+		}
+	};
+
+	std::vector<ClassTable> tables;
+};
+
+#endif
@@ -23,6 +23,7 @@
  */
 #include "TreeBuilder.h"
 
+#include "../Utilities/BuildProfiler.h"
 #include "../Utilities/MapExtensions.h"
 
 #include <limits>
@@ -31,45 +32,66 @@
 
 using namespace std;
 
-#define MaxDelta 16
-
 SpanRange GetSpan(const Rule& rule, uint8_t dim, uint8_t left, uint8_t right) { 
 	Point lp = rule.range[dim].low;
 	Point rp = rule.range[dim].high;
 	uint32_t mask = 0xFFFFFFFF >> (left + right);
+	// A range whose ends differ above the window wraps around it; prefixes then cover every child,
+	// and other ranges (port classes) are conservatively given every child too
+	if (left > 0 && ((lp ^ rp) >> (BitsPerField - left)) != 0) {
+		return SpanRange(0, mask);
+	}
 	uint32_t l = (lp >> right) & mask;
 	uint32_t r = (rp >> right) & mask;
 	return SpanRange(l, r);
 }
 
-tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpan(const vector<Rule>& rules, Allower isAllowed, int penaltyRate) {
+size_t TreeBuilder::CountChildren(RuleSpan rules, const Allower& isAllowed, uint8_t dim, uint8_t nl, uint8_t nr, uint32_t* counts, size_t& penalty) const {
+	// Difference array over the children, turned into per-child rule counts by a prefix sum
+	size_t numChildren = 0x1u << (BitsPerField - nl - nr);
+	fill(counts, counts + numChildren + 1, 0);
+	penalty = 0;
+	for (RuleIndex i : rules) {
+		const Rule& r = store[i];
+		if (isAllowed(r, dim, nl, nr)) {
+			SpanRange span = GetSpan(r, dim, nl, nr);
+			counts[span.first]++;
+			counts[span.second + 1]--;
+		} else {
+			penalty += 1;
+		}
+	}
+	size_t fitness = 0;
+	uint32_t running = 0;
+	for (size_t i = 0; i < numChildren; i++) {
+		running += counts[i];
+		counts[i] = running;
+		if (running > fitness) fitness = running;
+	}
+	return fitness;
+}
+
+tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpan(RuleSpan rules, Allower isAllowed, int penaltyRate) {
+	ProfileScope scope("BestSpan", rules.size());
 	
 	size_t bestCost = std::numeric_limits<size_t>::max();
 	uint8_t bestDim = 0;
 	uint8_t bestNl = 0;
 	uint8_t bestNr = 0;
 
-	for (uint8_t delta = BitsPerNybble; delta <= MaxDelta; delta += BitsPerNybble) {
+	uint8_t widest = CutLimit();
+	ScratchArena::Mark mark = arena.Position();
+	uint32_t* counts = arena.Allocate<uint32_t>((0x1u << widest) + 1);
+	for (uint8_t delta = BitsPerNybble; delta <= widest; delta += BitsPerNybble) {
 		for (uint8_t dim : allowableDims) {
 			for (uint8_t nl = 0; nl + delta <= BitsPerField; nl += BitsPerNybble) {
 				uint8_t nr = BitsPerField - nl - delta;
-				unordered_map<Point, size_t> counts;
-				size_t penalty = 0;
-				for (const Rule& r : rules) {
-					if (isAllowed(r, dim, nl, nr)) {
-						SpanRange span = GetSpan(r, dim, nl, nr);
-						for (Point i = span.first; i <= span.second; i++) {
-							counts[i]++;
-						}
-					} else {
-						penalty += 1;
-					}
-				}
-				size_t fitness = 0;
-				for (auto pair : counts) {
-					if (pair.second > fitness) fitness = pair.second;
-				}
-				fitness += penalty * penaltyRate;
+				size_t penalty;
+				size_t fitness = CountChildren(rules, isAllowed, dim, nl, nr, counts, penalty);
+				// Under the cache model a cut that admits no rule can still look cheap, but it makes no progress
+				if (cacheCost && penalty == rules.size()) continue;
+				fitness = WeightedFitness(counts, fitness, rules.size(), dim, nl, nr);
+				fitness = NodeCost(fitness, 0x1u << delta) + PenaltyCost(penalty, penaltyRate);
 		
 				if (fitness < bestCost) {
 					bestCost = fitness;
@@ -80,11 +102,13 @@ tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpan(const vector<Rule
 			}
 		}
 	}
+	arena.Release(mark);
 	
 	return tuple<uint8_t, uint8_t, uint8_t, size_t>(bestDim, bestNl, bestNr, bestCost);
 }
 
-tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPart(const vector<Rule>& rules, Allower isAllowed, int penaltyRate) {
+tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPart(RuleSpan rules, Allower isAllowed, int penaltyRate) {
+	ProfileScope scope("BestSpanMinPart", rules.size());
 	
 	size_t bestCost = std::numeric_limits<size_t>::max();
 	size_t bestPart = std::numeric_limits<size_t>::max();
@@ -92,27 +116,16 @@ tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPart(const vect
 	uint8_t bestNl = 0;
 	uint8_t bestNr = 0;
 
-	for (uint8_t delta = BitsPerNybble; delta <= MaxDelta; delta += BitsPerNybble) {
+	uint8_t widest = CutLimit();
+	ScratchArena::Mark mark = arena.Position();
+	uint32_t* counts = arena.Allocate<uint32_t>((0x1u << widest) + 1);
+	for (uint8_t delta = BitsPerNybble; delta <= widest; delta += BitsPerNybble) {
 		for (uint8_t dim : allowableDims) {
 			for (uint8_t nl = 0; nl + delta <= BitsPerField; nl += BitsPerNybble) {
 				uint8_t nr = BitsPerField - nl - delta;
-				unordered_map<Point, size_t> counts;
-				size_t penalty = 0;
-				for (const Rule& r : rules) {
-					if (isAllowed(r, dim, nl, nr)) {
-						SpanRange span = GetSpan(r, dim, nl, nr);
-						for (Point i = span.first; i <= span.second; i++) {
-							counts[i]++;
-						}
-					} else {
-						penalty += 1;
-					}
-				}
-				size_t fitness = 0;
-				for (auto pair : counts) {
-					if (pair.second > fitness) fitness = pair.second;
-				}
-				size_t cost = fitness + penalty * penaltyRate;
+				size_t penalty;
+				size_t fitness = CountChildren(rules, isAllowed, dim, nl, nr, counts, penalty);
+				size_t cost = NodeCost(fitness, 0x1u << delta) + PenaltyCost(penalty, penaltyRate);
 		
 				if ((fitness > 0 && fitness < bestPart) || (fitness == bestPart && cost < bestCost)) {
 					bestCost = cost;
@@ -124,12 +137,14 @@ tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPart(const vect
 			}
 		}
 	}
+	arena.Release(mark);
 
 	printf("Chosen: %lu\n", bestPart);
 	return tuple<uint8_t, uint8_t, uint8_t, size_t>(bestDim, bestNl, bestNr, bestCost);
 }
 
-tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPenalty(const vector<Rule>& rules, Allower isAllowed, int penaltyRate) {
+tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPenalty(RuleSpan rules, Allower isAllowed, int penaltyRate) {
+	ProfileScope scope("BestSpanMinPenalty", rules.size());
 	
 	size_t bestCost = std::numeric_limits<size_t>::max();
 	size_t bestPenalty = std::numeric_limits<size_t>::max();
@@ -137,27 +152,16 @@ tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPenalty(const v
 	uint8_t bestNl = 0;
 	uint8_t bestNr = 0;
 
-	for (uint8_t delta = BitsPerNybble; delta <= MaxDelta; delta += BitsPerNybble) {
+	uint8_t widest = CutLimit();
+	ScratchArena::Mark mark = arena.Position();
+	uint32_t* counts = arena.Allocate<uint32_t>((0x1u << widest) + 1);
+	for (uint8_t delta = BitsPerNybble; delta <= widest; delta += BitsPerNybble) {
 		for (uint8_t dim : allowableDims) {
 			for (uint8_t nl = 0; nl + delta <= BitsPerField; nl += BitsPerNybble) {
 				uint8_t nr = BitsPerField - nl - delta;
-				unordered_map<Point, size_t> counts;
-				size_t penalty = 0;
-				for (const Rule& r : rules) {
-					if (isAllowed(r, dim, nl, nr)) {
-						SpanRange span = GetSpan(r, dim, nl, nr);
-						for (Point i = span.first; i <= span.second; i++) {
-							counts[i]++;
-						}
-					} else {
-						penalty += 1;
-					}
-				}
-				size_t fitness = 0;
-				for (auto pair : counts) {
-					if (pair.second > fitness) fitness = pair.second;
-				}
-				size_t cost = fitness + penalty * penaltyRate;
+				size_t penalty;
+				size_t fitness = CountChildren(rules, isAllowed, dim, nl, nr, counts, penalty);
+				size_t cost = NodeCost(fitness, 0x1u << delta) + PenaltyCost(penalty, penaltyRate);
 		
 				if (penalty < bestPenalty || (penalty == bestPenalty && cost < bestCost)) {
 					bestCost = cost;
@@ -169,23 +173,30 @@ tuple<uint8_t, uint8_t, uint8_t, size_t> TreeBuilder::BestSpanMinPenalty(const v
 			}
 		}
 	}
+	arena.Release(mark);
 	
 	return tuple<uint8_t, uint8_t, uint8_t, size_t>(bestDim, bestNl, bestNr, bestCost);
 }
 
-tuple<uint8_t, uint16_t, size_t> TreeBuilder::BestSplit(const vector<Rule>& rules) {
+tuple<uint8_t, uint16_t, size_t> TreeBuilder::BestSplit(RuleSpan rules) {
+	ProfileScope scope("BestSplit", rules.size());
 	size_t bestCost = numeric_limits<size_t>::max();
 	uint8_t bestDim = 0;
 	uint16_t bestSplit = 0;
 	
+	ScratchArena::Mark mark = arena.Position();
+	Point* splits = arena.Allocate<Point>(rules.size());
 	for (uint8_t dim : splitDims) {
-		set<Point> splits;
-		for (const Rule& r : rules) {
-			splits.insert(r.range[dim].high);
+		for (size_t i = 0; i < rules.size(); i++) {
+			splits[i] = store[rules[i]].range[dim].high;
 		}
-		for (Point s : splits) {
+		sort(splits, splits + rules.size());
+		Point* splitsEnd = unique(splits, splits + rules.size());
+		for (Point* sp = splits; sp != splitsEnd; sp++) {
+			Point s = *sp;
 			size_t lc = 0, rc = 0;
-			for (const Rule& r : rules) {
+			for (RuleIndex i : rules) {
+				const Rule& r = store[i];
 				if (r.range[dim].low <= s) {
 					lc++;
 				}
@@ -194,6 +205,13 @@ tuple<uint8_t, uint16_t, size_t> TreeBuilder::BestSplit(const vector<Rule>& rule
 				}
 			}
 			size_t cost = max(lc, rc);
+			if (!traffic.empty() && cost < rules.size()) {
+				size_t hot = 0;
+				for (Packet p : traffic) {
+					hot += p[dim] <= s ? lc : rc;
+				}
+				cost = (hot + traffic.size() - 1) / traffic.size();
+			}
 			if (cost < bestCost) {
 				bestCost = cost;
 				bestDim = dim;
@@ -201,7 +219,107 @@ tuple<uint8_t, uint16_t, size_t> TreeBuilder::BestSplit(const vector<Rule>& rule
 			}
 		}
 	}
-	return tuple<uint8_t, uint16_t, size_t>(bestDim, bestSplit, bestCost);
+	arena.Release(mark);
+	return tuple<uint8_t, uint16_t, size_t>(bestDim, bestSplit, NodeCost(bestCost, 2));
+}
+
+void TreeBuilder::SetTraffic(const vector<Packet>& packets, size_t coldLeafSize) {
+	useTraffic = true;
+	trafficStore = packets;
+	traffic = PacketSpan(trafficStore.data(), trafficStore.size());
+	// Leaves store their rule count in a byte
+	this->coldLeafSize = min<size_t>(max(coldLeafSize, leafSize), numeric_limits<uint8_t>::max());
+}
+
+size_t TreeBuilder::WeightedFitness(const uint32_t* counts, size_t worst, size_t numRules, uint8_t dim, uint8_t nl, uint8_t nr) const {
+	// Cuts that leave some child with every rule are never preferred, whatever the traffic
+	if (traffic.empty() || worst >= numRules) return worst;
+	
+	uint32_t mask = 0xFFFFFFFF >> (nl + nr);
+	size_t hot = 0;
+	for (Packet p : traffic) {
+		hot += counts[(p[dim] >> nr) & mask];
+	}
+	return (hot + traffic.size() - 1) / traffic.size();
+}
+
+void TreeBuilder::SetMaxDelta(uint8_t delta) {
+	delta -= delta % BitsPerNybble;
+	maxDelta = max<uint8_t>(BitsPerNybble, min<uint8_t>(delta, MaxDelta));
+}
+
+size_t TreeBuilder::NodeCost(size_t childRules, size_t numChildren) const {
+	if (!cacheCost) return childRules;
+	// The node and its child slot, then one more node and slot per 16-way cut the child still needs,
+	// then a leaf scan
+	size_t levels = 0;
+	for (size_t n = childRules; n > leafSize; n = (n + 15) / 16) {
+		levels++;
+	}
+	size_t lines = 1 + SlotLines(numChildren * sizeof(ByteCutsNode*)) + 2 * levels + 1 + LinesOf(min(childRules, leafSize) * sizeof(Rule));
+	return lines * CostScale + min<size_t>(childRules, CostScale - 1);
+}
+
+size_t TreeBuilder::PenaltyCost(size_t penalty, int penaltyRate) const {
+	// Each pushed-out rule costs at least its own lines in a later tree
+	if (!cacheCost) return penalty * penaltyRate;
+	return LinesOf(penalty * sizeof(Rule)) * penaltyRate * CostScale;
+}
+
+int TreeBuilder::BudgetPressure() const {
+	if (!budget) return 0;
+	int pressure = 0;
+	for (Memory left = 2 * budget->Remaining(); left < budget->Limit() && pressure < MaxPressure; left = max<Memory>(2 * left, 1)) {
+		pressure++;
+	}
+	return pressure;
+}
+
+size_t TreeBuilder::LeafLimit() const {
+	size_t limit = (useTraffic && traffic.empty()) ? coldLeafSize : leafSize;
+	// Leaves store their rule count in a byte
+	return min<size_t>(limit << BudgetPressure(), numeric_limits<uint8_t>::max());
+}
+
+uint8_t TreeBuilder::CutLimit() const {
+	// Narrower cuts replicate more rules, so they only start once leaves have grown eightfold
+	int narrowing = max(0, BudgetPressure() - 2);
+	uint8_t delta = maxDelta - min<int>(BitsPerNybble * narrowing, maxDelta - BitsPerNybble);
+	// Uncompressed, one child array may not take more than the budget left
+	while (budget && !compressCuts && delta > BitsPerNybble && (sizeof(ByteCutsNode*) << delta) > budget->Remaining()) {
+		delta -= BitsPerNybble;
+	}
+	return delta;
+}
+
+void TreeBuilder::Reserve(size_t numRules) {
+	if (budget) {
+		budget->Charge(numRules * sizeof(Rule));
+	}
+}
+
+void TreeBuilder::Release(size_t numRules) {
+	if (budget) {
+		budget->Refund(numRules * sizeof(Rule));
+	}
+}
+
+template <class Build>
+ByteCutsNode* TreeBuilder::BuildCharged(Memory& bytes, Build build) {
+	Memory before = budget ? budget->Used() : 0;
+	ByteCutsNode* node = build();
+	if (budget) {
+		bytes = budget->Used() - before;
+		budget->Refund(bytes);
+	}
+	return node;
+}
+
+ByteCutsNode* TreeBuilder::Charge(ByteCutsNode* node) {
+	if (budget) {
+		budget->Charge(node->OwnBytes());
+	}
+	return node;
 }
 
 bool AllowAll(const Rule& r, uint8_t dim, uint8_t nl, uint8_t nr) {
@@ -223,117 +341,242 @@ void CleanRules(vector<Rule>& rules) {
 	rules.erase(unique(rules.begin(), rules.end(), [](const Rule& r1, const Rule& r2) { return r1.priority == r2.priority;} ), rules.end());
 }
 
-ByteCutsNode* TreeBuilder::BuildNode(const vector<Rule>& rules, vector<Rule>& remain, int depth, int penaltyRate) {
-	return BuildNodeHelper(rules, remain, depth, LimitedSplit, [&](const vector<Rule>& rl, vector<Rule>& rmn, int dep, int pr) { return BuildNode(rl, rmn, dep, pr); }, penaltyRate);
+void CleanRules(vector<RuleIndex>& rules) {
+	// Indices into a priority-sorted store: ascending index is descending priority
+	sort(rules.begin(), rules.end());
+	rules.erase(unique(rules.begin(), rules.end()), rules.end());
+}
+
+ByteCutsNode* TreeBuilder::BuildNode(RuleSpan rules, vector<RuleIndex>& remain, int depth, int penaltyRate) {
+	return BuildNodeHelper(rules, remain, depth, LimitedSplit, [&](RuleSpan rl, vector<RuleIndex>& rmn, int dep, int pr) { return BuildNode(rl, rmn, dep, pr); }, penaltyRate);
 }
 
-ByteCutsNode* TreeBuilder::BuildPrimaryRoot(const vector<Rule>& rules, vector<Rule>& remain) {
+ByteCutsNode* TreeBuilder::BuildPrimaryRoot(const vector<RuleIndex>& rules, vector<RuleIndex>& remain) {
 	numNodes = 0;
-	return BuildNode(rules, remain, 0, 5);
+	arena.Reset();
+	traffic = PacketSpan(trafficStore.data(), trafficStore.size());
+	ResetRegion();
+	Reserve(rules.size());
+	ByteCutsNode* node = BuildNode(RuleSpan(rules.data(), rules.size()), remain, 0, primaryPenalty);
+	Release(rules.size());
+	
+	// Rules pushed out of several children come back once each, in priority order, for the next tree's leaves
+	CleanRules(remain);
+	
+	return node;
 }
 
-ByteCutsNode* TreeBuilder::BuildSecondaryRoot(const vector<Rule>& rules, vector<Rule>& remain) {
+ByteCutsNode* TreeBuilder::BuildSecondaryRoot(const vector<RuleIndex>& rules, vector<RuleIndex>& remain) {
 	numNodes = 0;
-	auto node = BuildRootHelper(rules, remain, 0, LimitedSplit, [&](const vector<Rule>& rl, vector<Rule>& rmn, int depth, int pr) { return BuildNode(rl, rmn, depth, pr); }, 1);
+	arena.Reset();
+	traffic = PacketSpan(trafficStore.data(), trafficStore.size());
+	ResetRegion();
+	Reserve(rules.size());
+	auto node = BuildRootHelper(RuleSpan(rules.data(), rules.size()), remain, 0, LimitedSplit, [&](RuleSpan rl, vector<RuleIndex>& rmn, int depth, int pr) { return BuildNode(rl, rmn, depth, pr); }, secondaryPenalty);
+	Release(rules.size());
 
 	CleanRules(remain);
 	
 	return node;
 }
 
-ByteCutsNode* TreeBuilder::BuildCutNode(const vector<Rule>& rules, vector<Rule>& remain, int depth, Allower isAllowed, Builder builder, int penaltyRate, uint8_t d, uint8_t nl, uint8_t nr) {
-	vector<Rule> inrules;
-	for (const Rule& rule : rules) {
-		if (isAllowed(rule, d, nl, nr)) {
-			inrules.push_back(rule);
+ByteCutsNode* TreeBuilder::BuildLeaf(RuleSpan rules) {
+	ProfileScope scope("BuildLeaf", rules.size());
+	ByteCutsNode* node = new ByteCutsNode();
+	ByteCutsNode::LeafNode(*node, store, rules.begin(), rules.size(), region);
+	return Charge(node);
+}
+
+void TreeBuilder::ResetRegion() {
+	for (size_t d = 0; d < NumDims; d++) {
+		region[d] = domain[d];
+	}
+}
+
+Interval TreeBuilder::CutRegion(uint8_t d, uint8_t nl, uint8_t nr, uint32_t first, uint32_t last) const {
+	Interval r = region[d];
+	// The children only cover intervals once the bits above the window are fixed
+	if (nl > 0 && ((r.low ^ r.high) >> (BitsPerField - nl)) != 0) return r;
+	Point prefix = (nl > 0) ? r.low & ~(0xFFFFFFFFu >> nl) : 0;
+	Point low = prefix | (Point(first) << nr);
+	Point high = prefix | (Point(last) << nr) | (nr > 0 ? 0xFFFFFFFFu >> (BitsPerField - nr) : 0);
+	if (high < r.low || low > r.high) return r;
+	return Interval{max(r.low, low), min(r.high, high)};
+}
+
+ByteCutsNode* TreeBuilder::BuildCappedLeaf(RuleSpan rules, vector<RuleIndex>& remain) {
+	size_t kept = min(rules.size(), LeafLimit());
+	remain.insert(remain.end(), rules.begin() + kept, rules.end());
+	return BuildLeaf(RuleSpan(rules.begin(), kept));
+}
+
+ByteCutsNode* TreeBuilder::BuildCutNode(RuleSpan rules, vector<RuleIndex>& remain, int depth, Allower isAllowed, Builder builder, int penaltyRate, uint8_t d, uint8_t nl, uint8_t nr) {
+	ProfileScope scope("BuildCutNode", rules.size());
+	ScratchArena::Mark mark = arena.Position();
+	
+	RuleIndex* in = arena.Allocate<RuleIndex>(rules.size());
+	size_t numIn = 0;
+	for (RuleIndex i : rules) {
+		if (isAllowed(store[i], d, nl, nr)) {
+			in[numIn++] = i;
 		} else {
-			remain.push_back(rule);
+			remain.push_back(i);
 		}
 	}
+	RuleSpan inrules(in, numIn);
 	
 	if (inrules.empty()) {
-		// Shouldn't happen
-		ByteCutsNode* node = new ByteCutsNode();
-		ByteCutsNode::LeafNode(*node, rules);
-		remain.clear();
-		PrintRules(rules);
+		// No allowed cut admits any rule: keep them all in a leaf here rather than in the next tree.
+		// They were the last rules pushed, so rules pushed earlier by sibling subtrees stay in remain
+		ByteCutsNode* node = BuildLeaf(rules);
+		remain.resize(remain.size() - rules.size());
+		arena.Release(mark);
 		return node;
 	}
 
 	size_t numChildren = 0x1 << (BitsPerField - nl - nr);
-	unordered_map<vector<bool>, ByteCutsNode*> composer;
-	ByteCutsNode** children = new ByteCutsNode*[numChildren];
-	for (size_t i = 0; i < numChildren; i++) {
+	
+	// The set of rules covering a child only changes where some rule's span starts or ends
+	SpanRange* spans = arena.Allocate<SpanRange>(inrules.size());
+	uint32_t* bounds = arena.Allocate<uint32_t>(2 * inrules.size() + 1);
+	size_t numBounds = 0;
+	for (size_t j = 0; j < inrules.size(); j++) {
+		spans[j] = GetSpan(store[inrules[j]], d, nl, nr);
+		bounds[numBounds++] = spans[j].first;
+		bounds[numBounds++] = spans[j].second + 1;
+	}
+	bounds[numBounds++] = numChildren;
+	sort(bounds, bounds + numBounds);
+	numBounds = unique(bounds, bounds + numBounds) - bounds;
+	
+	unordered_map<vector<bool>, uint32_t> composer;
+	vector<RuleSpan> groups;
+	vector<SpanRange> groupSpans;
+	uint32_t* groupOf = arena.Allocate<uint32_t>(numChildren);
+	size_t lo = 0;
+	for (size_t b = 0; b < numBounds && lo < numChildren; b++) {
+		size_t hi = bounds[b];
+		if (hi <= lo) continue;
 		vector<bool> brl(inrules.size(), false);
+		size_t numRules = 0;
 		for (size_t j = 0; j < inrules.size(); j++) {
-			const Rule& rule = inrules[j];
-			auto s = GetSpan(rule, d, nl, nr);
-			if (s.first <= i && i <= s.second) {
+			if (spans[j].first <= lo && lo <= spans[j].second) {
 				brl[j] = true;
+				numRules++;
 			}
 		}
-		if (!composer.count(brl)) {
-			vector<Rule> rl;
+		auto it = composer.find(brl);
+		if (it == composer.end()) {
+			RuleIndex* rl = arena.Allocate<RuleIndex>(numRules);
+			size_t k = 0;
 			for (size_t j = 0; j < inrules.size(); j++) {
-				if (brl[j]){
-					rl.push_back(inrules[j]);
+				if (brl[j]) {
+					rl[k++] = inrules[j];
 				}
 			}
-			auto node = builder(rl, remain, depth + 1, penaltyRate);
-			composer[brl] = node;
+			it = composer.emplace(brl, groups.size()).first;
+			groups.push_back(RuleSpan(rl, numRules));
+			groupSpans.push_back(SpanRange(lo, hi - 1));
 		}
-		children[i] = composer[brl];
+		// A group's child sees the packets of every index it serves
+		groupSpans[it->second].second = hi - 1;
+		fill(groupOf + lo, groupOf + hi, it->second);
+		lo = hi;
+	}
+	scope.AddComposer(composer.size());
+	
+	// Bucket the traffic reaching this node by the child group it falls into
+	PacketSpan nodeTraffic = traffic;
+	size_t* groupStart = arena.Allocate<size_t>(groups.size() + 1);
+	fill(groupStart, groupStart + groups.size() + 1, 0);
+	uint32_t mask = 0xFFFFFFFF >> (nl + nr);
+	for (Packet p : nodeTraffic) {
+		groupStart[groupOf[(p[d] >> nr) & mask] + 1]++;
+	}
+	partial_sum(groupStart, groupStart + groups.size() + 1, groupStart);
+	Packet* bucketed = arena.Allocate<Packet>(nodeTraffic.size());
+	size_t* groupFill = arena.Allocate<size_t>(groups.size());
+	copy(groupStart, groupStart + groups.size(), groupFill);
+	for (Packet p : nodeTraffic) {
+		bucketed[groupFill[groupOf[(p[d] >> nr) & mask]]++] = p;
+	}
+	
+	// Children not yet built hold their rules back from the budget, so that earlier siblings see the pressure
+	for (RuleSpan group : groups) {
+		Reserve(group.size());
 	}
+	ByteCutsNode** built = arena.Allocate<ByteCutsNode*>(groups.size());
+	Interval nodeRegion = region[d];
+	for (size_t g = 0; g < groups.size(); g++) {
+		traffic = PacketSpan(bucketed + groupStart[g], groupStart[g + 1] - groupStart[g]);
+		region[d] = CutRegion(d, nl, nr, groupSpans[g].first, groupSpans[g].second);
+		built[g] = builder(groups[g], remain, depth + 1, penaltyRate);
+		Release(groups[g].size());
+	}
+	traffic = nodeTraffic;
+	region[d] = nodeRegion;
+	
+	ByteCutsNode** children = new ByteCutsNode*[numChildren];
+	for (size_t i = 0; i < numChildren; i++) {
+		children[i] = built[groupOf[i]];
+	}
+	arena.Release(mark);
+	
 	ByteCutsNode* node = new ByteCutsNode();
-	ByteCutsNode::CutNode(*node, d, nl, nr, children);
-	return node;
+	ByteCutsNode::CutNode(*node, d, nl, nr, children, compressCuts);
+	return Charge(node);
 }
 
-ByteCutsNode* TreeBuilder::BuildRootHelper(const vector<Rule>& rules, vector<Rule>& remain, int depth, Allower isAllowed, Builder builder, int penaltyRate) {
+ByteCutsNode* TreeBuilder::BuildRootHelper(RuleSpan rules, vector<RuleIndex>& remain, int depth, Allower isAllowed, Builder builder, int penaltyRate) {
 	numNodes++;
 
-	if (rules.size() <= leafSize) {
-		ByteCutsNode* node = new ByteCutsNode();
-		ByteCutsNode::LeafNode(*node, rules);
-		return node;
+	if (rules.size() <= LeafLimit()) {
+		return BuildLeaf(rules);
+	} else if (AtMaxDepth(depth)) {
+		return BuildCappedLeaf(rules, remain);
 	} else {
-		vector<Rule> remainCost, remainPart, remainPenalty;
+		vector<RuleIndex> remainCost, remainPart, remainPenalty;
 		uint8_t d, nl, nr;
 		size_t c;
+		// Each candidate is built against the budget left before any of them, and the losers are refunded
+		Memory costBytes = 0, partBytes = 0, penaltyBytes = 0;
 		tie(d, nl, nr, c) = BestSpan(rules, isAllowed, penaltyRate);
-		ByteCutsNode* costNode = BuildCutNode(rules, remainCost, depth, isAllowed, builder, penaltyRate, d, nl, nr);
+		ByteCutsNode* costNode = BuildCharged(costBytes, [&]() { return BuildCutNode(rules, remainCost, depth, isAllowed, builder, penaltyRate, d, nl, nr); });
 		tie(d, nl, nr, c) = BestSpanMinPart(rules, isAllowed, penaltyRate);
-		ByteCutsNode* partNode = BuildCutNode(rules, remainPart, depth, isAllowed, builder, penaltyRate, d, nl, nr);
+		ByteCutsNode* partNode = BuildCharged(partBytes, [&]() { return BuildCutNode(rules, remainPart, depth, isAllowed, builder, penaltyRate, d, nl, nr); });
 		tie(d, nl, nr, c) = BestSpanMinPenalty(rules, isAllowed, penaltyRate);
-		ByteCutsNode* penaltyNode = BuildCutNode(rules, remainPenalty, depth, isAllowed, builder, penaltyRate, d, nl, nr);
+		ByteCutsNode* penaltyNode = BuildCharged(penaltyBytes, [&]() { return BuildCutNode(rules, remainPenalty, depth, isAllowed, builder, penaltyRate, d, nl, nr); });
 		
 		size_t minRemain = min({remainCost.size(), remainPart.size(), remainPenalty.size()});
 		if (remainCost.size() == minRemain) {
-			remain = remainCost;
+			remain.swap(remainCost);
 			delete partNode;
 			delete penaltyNode;
+			if (budget) budget->Charge(costBytes);
 			return costNode;
 		} else if (remainPart.size() == minRemain) {
-			remain = remainPart;
+			remain.swap(remainPart);
 			delete costNode;
 			delete penaltyNode;
+			if (budget) budget->Charge(partBytes);
 			return partNode;
 		} else {
-			remain = remainPenalty;
+			remain.swap(remainPenalty);
 			delete costNode;
 			delete partNode;
+			if (budget) budget->Charge(penaltyBytes);
 			return penaltyNode;
 		}
 	}
 }
 
-ByteCutsNode* TreeBuilder::BuildNodeHelper(const vector<Rule>& rules, vector<Rule>& remain, int depth, Allower isAllowed, Builder builder, int penaltyRate) {
+ByteCutsNode* TreeBuilder::BuildNodeHelper(RuleSpan rules, vector<RuleIndex>& remain, int depth, Allower isAllowed, Builder builder, int penaltyRate) {
 	numNodes++;
 
-	if (rules.size() <= leafSize) {
-		ByteCutsNode* node = new ByteCutsNode();
-		ByteCutsNode::LeafNode(*node, rules);
-		return node;
+	if (rules.size() <= LeafLimit()) {
+		return BuildLeaf(rules);
+	} else if (AtMaxDepth(depth)) {
+		return BuildCappedLeaf(rules, remain);
 	} else {
 		uint8_t d, nl, nr;
 		size_t c;
@@ -346,26 +589,43 @@ ByteCutsNode* TreeBuilder::BuildNodeHelper(const vector<Rule>& rules, vector<Rul
 		tie(ds, ss, cs) = BestSplit(rules);
 		size_t cMin = min(c, cs);
 		
-		if (cMin == rules.size()) {
+		if (cMin >= NodeCost(rules.size(), 2)) {
 			// degenerate case: no improvement
-			ByteCutsNode* node = new ByteCutsNode();
-			ByteCutsNode::LeafNode(*node, rules);
-			return node;
+			return BuildLeaf(rules);
 		} else if (c == cMin) {
 			return BuildCutNode(rules, remain, depth, isAllowed, builder, penaltyRate, d, nl, nr);
 		} else {
 			madeHyperSplit = true;
-			vector<Rule> lefts;
-			vector<Rule> rights;
-			for (const Rule& r : rules) {
-				if (r.range[ds].low <= ss) lefts.push_back(r);
-				if (r.range[ds].high > ss) rights.push_back(r);
+			ProfileScope scope("BuildSplitNode", rules.size());
+			ScratchArena::Mark mark = arena.Position();
+			RuleIndex* lefts = arena.Allocate<RuleIndex>(rules.size());
+			RuleIndex* rights = arena.Allocate<RuleIndex>(rules.size());
+			size_t numLeft = 0, numRight = 0;
+			for (RuleIndex i : rules) {
+				const Rule& r = store[i];
+				if (r.range[ds].low <= ss) lefts[numLeft++] = i;
+				if (r.range[ds].high > ss) rights[numRight++] = i;
+			}
+			PacketSpan nodeTraffic = traffic;
+			Packet* sides = arena.Allocate<Packet>(nodeTraffic.size());
+			size_t numLeftTraffic = 0, numRightTraffic = nodeTraffic.size();
+			for (Packet p : nodeTraffic) {
+				if (p[ds] <= ss) sides[numLeftTraffic++] = p;
+				else sides[--numRightTraffic] = p;
 			}
-			ByteCutsNode* lc = builder(lefts, remain, depth + 1, penaltyRate);
-			ByteCutsNode* rc = builder(rights, remain, depth + 1, penaltyRate);
+			Interval nodeRegion = region[ds];
+			traffic = PacketSpan(sides, numLeftTraffic);
+			region[ds] = (ss >= nodeRegion.low) ? Interval{nodeRegion.low, min<Point>(nodeRegion.high, ss)} : nodeRegion;
+			ByteCutsNode* lc = builder(RuleSpan(lefts, numLeft), remain, depth + 1, penaltyRate);
+			traffic = PacketSpan(sides + numLeftTraffic, nodeTraffic.size() - numLeftTraffic);
+			region[ds] = (ss < nodeRegion.high) ? Interval{max<Point>(nodeRegion.low, ss + 1), nodeRegion.high} : nodeRegion;
+			ByteCutsNode* rc = builder(RuleSpan(rights, numRight), remain, depth + 1, penaltyRate);
+			traffic = nodeTraffic;
+			region[ds] = nodeRegion;
+			arena.Release(mark);
 			ByteCutsNode* node = new ByteCutsNode();
 			ByteCutsNode::SplitNode(*node, ds, ss, lc, rc);
-			return node;
+			return Charge(node);
 		}
 	}
 }
@@ -26,57 +26,172 @@
 #define TreeBuilder_H
 
 #include "ByteCutsNode.h"
+#include "../Utilities/Arena.h"
+
+// Widest cut, in bits, that cut selection considers
+#define MaxDelta 16
+// Budget pressure beyond which leaves and cuts degrade no further
+#define MaxPressure 8
+// Under the cache model costs are estimated cache lines per lookup, scaled so that the child's rule
+// count breaks ties and a cut that leaves a child with every rule is never cheaper than a degenerate split
+#define CostScale 65536
+
+typedef ScratchSpan<const RuleIndex> RuleSpan;
+typedef ScratchSpan<const Packet> PacketSpan;
 
 SpanRange GetSpan(const Rule& rule, uint8_t dim, uint8_t left, uint8_t right);
+// Admits a rule to a cut when it spans at most 16 of the cut's children; others are pushed to later trees
+bool LimitedSplit(const Rule& r, uint8_t dim, uint8_t nl, uint8_t nr);
 void CleanRules(std::vector<Rule>& rules);
+void CleanRules(std::vector<RuleIndex>& rules);
+
+// Running estimate of the bytes a forest takes while it is built, against a cap
+// Builders charge every node they keep; the cap steers construction but is not enforced
+class MemoryBudget {
+public:
+	explicit MemoryBudget(Memory limit) : limit(limit) {}
 
+	void Charge(Memory bytes) { used += bytes; }
+	void Refund(Memory bytes) { used -= bytes; }
+	Memory Limit() const { return limit; }
+	Memory Used() const { return used; }
+	Memory Remaining() const { return used < limit ? limit - used : 0; }
+	bool Exhausted() const { return used >= limit; }
+private:
+	Memory limit;
+	Memory used = 0;
+};
+
+// Builds trees over indices into an immutable, priority-sorted rule store
+// Per-node temporaries live in a scratch arena that is rewound as each subtree completes
 class TreeBuilder {
 public:
 	typedef std::function<bool(const Rule&, uint8_t dim, uint8_t nl, uint8_t nr)> Allower;
-	typedef std::function<ByteCutsNode*(const std::vector<Rule>&, std::vector<Rule>&, int, int)> Builder;
+	typedef std::function<ByteCutsNode*(RuleSpan, std::vector<RuleIndex>&, int, int)> Builder;
 
-	TreeBuilder(size_t leafSize) : leafSize(leafSize) {
-		allowableDims = {0, 1, 4};
-		splitDims = {2, 3};
+	TreeBuilder(const std::vector<Rule>& store, size_t leafSize) : store(store), leafSize(leafSize), coldLeafSize(leafSize) {
+		for (uint8_t w = 0; w < WordsPerAddress; w++) {
+			allowableDims.push_back(FieldSA + w);
+		}
+		for (uint8_t w = 0; w < WordsPerAddress; w++) {
+			allowableDims.push_back(FieldDA + w);
+		}
+		allowableDims.push_back(FieldProto);
+		splitDims = {FieldSP, FieldDP};
+		for (size_t d = 0; d < NumDims; d++) {
+			domain[d] = Interval{0, HeaderMax(d)};
+		}
+		ResetRegion();
 	}
 
-	std::tuple<uint8_t, uint8_t, uint8_t, size_t> BestSpan(const std::vector<Rule>& rules, Allower isAllowed, int penaltyRate);
-	std::tuple<uint8_t, uint8_t, uint8_t, size_t> BestSpanMinPart(const std::vector<Rule>& rules, Allower isAllowed, int penaltyRate);
-	std::tuple<uint8_t, uint8_t, uint8_t, size_t> BestSpanMinPenalty(const std::vector<Rule>& rules, Allower isAllowed, int penaltyRate);
-	std::tuple<uint8_t, uint16_t, size_t> BestSplit(const std::vector<Rule>& rules);
+	// Sample packets used to weight cut selection by expected lookup cost
+	// Nodes that no sample packet reaches are allowed leaves of up to coldLeafSize rules
+	void SetTraffic(const std::vector<Packet>& packets, size_t coldLeafSize);
+	// Whether cut nodes may store their child arrays compressed
+	void SetCompressCuts(bool compress) { compressCuts = compress; }
+	// Widest cut considered, in bits; rounded down to whole nybbles and capped at 16
+	void SetMaxDelta(uint8_t delta);
+	// Penalty rates weighing rules pushed out of a node against the cut's size, for primary and secondary trees
+	void SetPenaltyRates(int primary, int secondary) {
+		primaryPenalty = primary;
+		secondaryPenalty = secondary;
+	}
+	// Scores cuts and splits by the cache lines a lookup is estimated to touch instead of by rule counts
+	void SetCacheCost(bool cache) { cacheCost = cache; }
+	// Charges built nodes to the budget; as it runs low, cuts narrow and leaves grow
+	void SetBudget(MemoryBudget* budget) { this->budget = budget; }
+	// Most levels of nodes a lookup may pass through; nodes at the last level become leaves and push the overflow out
+	void SetMaxDepth(int depth) { maxDepth = depth; }
+	// Lets cut nodes cut the port dimensions too, for rules whose ports hold dense class IDs
+	void SetCutPorts() {
+		allowableDims.push_back(FieldSP);
+		allowableDims.push_back(FieldDP);
+	}
+	// Values packets take in a dimension, when they are not the header field's, as for class IDs
+	void SetDomain(uint8_t dim, Interval values) { domain[dim] = values; }
+
+	std::tuple<uint8_t, uint8_t, uint8_t, size_t> BestSpan(RuleSpan rules, Allower isAllowed, int penaltyRate);
+	std::tuple<uint8_t, uint8_t, uint8_t, size_t> BestSpanMinPart(RuleSpan rules, Allower isAllowed, int penaltyRate);
+	std::tuple<uint8_t, uint8_t, uint8_t, size_t> BestSpanMinPenalty(RuleSpan rules, Allower isAllowed, int penaltyRate);
+	std::tuple<uint8_t, uint16_t, size_t> BestSplit(RuleSpan rules);
 	
-	ByteCutsNode* BuildNode(const std::vector<Rule>& rules, std::vector<Rule>& remain, int depth, int penaltyRate);
-	ByteCutsNode* BuildPrimaryRoot(const std::vector<Rule>& rules, std::vector<Rule>& remain);
-	ByteCutsNode* BuildSecondaryRoot(const std::vector<Rule>& rules, std::vector<Rule>& remain);
+	ByteCutsNode* BuildNode(RuleSpan rules, std::vector<RuleIndex>& remain, int depth, int penaltyRate);
+	ByteCutsNode* BuildPrimaryRoot(const std::vector<RuleIndex>& rules, std::vector<RuleIndex>& remain);
+	ByteCutsNode* BuildSecondaryRoot(const std::vector<RuleIndex>& rules, std::vector<RuleIndex>& remain);
 	
 	bool BuiltSplit() const { return madeHyperSplit; }
+	size_t ScratchBytes() const { return arena.Capacity(); }
 private:
 	ByteCutsNode* BuildNodeHelper(
-			const std::vector<Rule>& rules, 
-			std::vector<Rule>& remain, 
+			RuleSpan rules, 
+			std::vector<RuleIndex>& remain, 
 			int depth,
 			Allower isAllowed, 
 			Builder builder,
 			int penaltyRate);
 	ByteCutsNode* BuildRootHelper(
-			const std::vector<Rule>& rules, 
-			std::vector<Rule>& remain, 
+			RuleSpan rules, 
+			std::vector<RuleIndex>& remain, 
 			int depth,
 			Allower isAllowed, 
 			Builder builder,
 			int penaltyRate);
 	ByteCutsNode* BuildCutNode(
-			const std::vector<Rule>& rules, 
-			std::vector<Rule>& remain, 
+			RuleSpan rules, 
+			std::vector<RuleIndex>& remain, 
 			int depth,
 			Allower isAllowed, 
 			Builder builder,
 			int penaltyRate,
 			uint8_t d, uint8_t nl, uint8_t nr);
+	ByteCutsNode* BuildLeaf(RuleSpan rules);
+	// Resets region to the whole domain, for a new root
+	void ResetRegion();
+	// region[d] narrowed to packets whose cut window in d falls between the child indices first and last
+	Interval CutRegion(uint8_t d, uint8_t nl, uint8_t nr, uint32_t first, uint32_t last) const;
+	// At the depth limit: a leaf of the highest-priority rules, the rest left for the next tree
+	bool AtMaxDepth(int depth) const { return maxDepth > 0 && depth + 1 >= maxDepth; }
+	ByteCutsNode* BuildCappedLeaf(RuleSpan rules, std::vector<RuleIndex>& remain);
+	ByteCutsNode* Charge(ByteCutsNode* node);
+	// Until a subtree is built, the budget holds back the least it can take: each of its rules stored once
+	void Reserve(size_t numRules);
+	void Release(size_t numRules);
+	// Runs build and leaves what it charged out of the budget, reported in bytes
+	template <class Build>
+	ByteCutsNode* BuildCharged(Memory& bytes, Build build);
+
+	size_t CountChildren(RuleSpan rules, const Allower& isAllowed, uint8_t dim, uint8_t nl, uint8_t nr, uint32_t* counts, size_t& penalty) const;
+	size_t WeightedFitness(const uint32_t* counts, size_t worst, size_t numRules, uint8_t dim, uint8_t nl, uint8_t nr) const;
+	// How many times the budget left has halved below half the cap; 0 without a budget
+	int BudgetPressure() const;
+	size_t LeafLimit() const;
+	uint8_t CutLimit() const;
+	size_t NodeCost(size_t childRules, size_t numChildren) const;
+	size_t PenaltyCost(size_t penalty, int penaltyRate) const;
+
+	const std::vector<Rule>& store;
+	ScratchArena arena;
 
 	std::vector<uint8_t> allowableDims;
 	std::vector<uint8_t> splitDims;
 	size_t leafSize;
+	size_t coldLeafSize;
+	bool compressCuts = true;
+	uint8_t maxDelta = MaxDelta;
+	int primaryPenalty = 5;
+	int secondaryPenalty = 1;
+	bool cacheCost = false;
+	MemoryBudget* budget = nullptr;
+	int maxDepth = 0;
+
+	bool useTraffic = false;
+	std::vector<Packet> trafficStore;
+	PacketSpan traffic;
+	
+	// Box holding every packet that can reach the node being built, so leaves can skip fields it already fixes
+	Interval domain[NumDims];
+	Interval region[NumDims];
+	
 	size_t numNodes = 0;
 	
 	bool madeHyperSplit = false;
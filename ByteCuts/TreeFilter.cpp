@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "TreeFilter.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+TreeFilter::TreeFilter(const vector<Rule>& store, const vector<RuleIndex>& rules) {
+	for (int d = 0; d < NumDims; d++) {
+		bounds[d].low = numeric_limits<Point>::max();
+		bounds[d].high = 0;
+	}
+	for (RuleIndex i : rules) {
+		for (int d = 0; d < NumDims; d++) {
+			bounds[d].low = min(bounds[d].low, store[i].range[d].low);
+			bounds[d].high = max(bounds[d].high, store[i].range[d].high);
+		}
+	}
+	
+	// The address word whose rule ranges cover the fewest top-16-bit values gets the bitmap
+	const size_t NumValues = 1u << (BitsPerField - TopBits);
+	size_t bestCovered = NumValues;
+	vector<uint64_t> bestBitmap;
+	vector<int> edges(NumValues + 1);
+	for (int d = FieldSA; d < FieldSP; d++) {
+		fill(edges.begin(), edges.end(), 0);
+		for (RuleIndex i : rules) {
+			edges[store[i].range[d].low >> TopBits]++;
+			edges[(store[i].range[d].high >> TopBits) + 1]--;
+		}
+		vector<uint64_t> candidate(NumValues / 64, 0);
+		size_t covered = 0;
+		int running = 0;
+		for (size_t v = 0; v < NumValues; v++) {
+			running += edges[v];
+			if (running > 0) {
+				candidate[v >> 6] |= 1ull << (v & 63);
+				covered++;
+			}
+		}
+		if (covered < bestCovered) {
+			bestCovered = covered;
+			bitmapDim = d;
+			bestBitmap.swap(candidate);
+		}
+	}
+	// The bounds already reject everything outside the covered span; keep the bitmap only when it
+	// rejects at least a quarter of the values inside it
+	if (!rules.empty()) {
+		Point span = (bounds[bitmapDim].high >> TopBits) - (bounds[bitmapDim].low >> TopBits) + 1;
+		if (bestCovered * 4 <= span * 3) {
+			bitmap.swap(bestBitmap);
+		}
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef TREE_FILTER_H
+#define TREE_FILTER_H
+
+#include <vector>
+#include "ByteCutsNode.h"
+
+// Quick-reject test for one tree, checked before descending it
+// A packet outside the bounding box of the tree's rules, or whose top 16 bits in the most selective
+// address word fall in no rule's range, cannot match any rule of the tree
+class TreeFilter {
+public:
+	// Built from the rules the tree actually holds
+	TreeFilter(const std::vector<Rule>& store, const std::vector<RuleIndex>& rules);
+
+	bool MayMatch(const Packet& p) const {
+		for (int d = 0; d < NumDims; d++) {
+			if (p[d] < bounds[d].low || p[d] > bounds[d].high) return false;
+		}
+		if (bitmap.empty()) return true;
+		Point top = p[bitmapDim] >> TopBits;
+		return (bitmap[top >> 6] >> (top & 63)) & 1;
+	}
+
+	Memory MemSizeBytes() const {
+		return sizeof(TreeFilter) + bitmap.size() * sizeof(uint64_t);
+	}
+	// Most cache lines one test can touch: the filter as stored in an array, and one bitmap word
+	size_t WorstCaseLines() const {
+		return BlockLines(sizeof(TreeFilter), alignof(TreeFilter), false) + (bitmap.empty() ? 0 : 1);
+	}
+private:
+	static const int TopBits = 16;
+
+	Interval bounds[NumDims];
+	uint8_t bitmapDim = 0;
+	// One bit per value of the top 16 bits of bitmapDim; empty when it would reject too little to pay for itself
+	std::vector<uint64_t> bitmap;
+};
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "Tuner.h"
+
+#include "../Utilities/MapExtensions.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+// Values each tuned parameter is drawn from; the first of each is the default
+static const vector<pair<string, vector<string>>> TunedParams = {
+	{"BC.BadFraction", {"0.02", "0.005", "0.01", "0.05", "0.1"}},
+	{"BC.TurningPoint", {"0.01", "0.005", "0.02", "0.05"}},
+	{"BC.MinFraction", {"0.75", "0.5", "0.6", "0.9"}},
+	{"BC.LeafSize", {"8", "4", "16", "32"}},
+	{"BC.MaxDelta", {"16", "8", "12"}},
+	{"BC.PrimaryPenalty", {"5", "1", "2", "10"}},
+	{"BC.SecondaryPenalty", {"1", "0", "2", "5"}},
+	{"BC.CostModel", {"Rules", "Cache"}},
+};
+
+ByteCutsTuner::ByteCutsTuner(const unordered_map<string, string>& args, const vector<Rule>& rules, const vector<Packet>& sample)
+	: args(args), rules(rules), sample(sample),
+	keep(max(1u, GetUIntOrElse(args, "Tune.Keep", 4))),
+	threads(max(1u, GetUIntOrElse(args, "Threads", thread::hardware_concurrency()))) {
+	Sample(max(1u, GetUIntOrElse(args, "Tune", 16)), GetUIntOrElse(args, "Tune.Seed", 1));
+}
+
+void ByteCutsTuner::Sample(size_t numCandidates, unsigned seed) {
+	mt19937 generator(seed);
+	vector<string> seen;
+	// The defaults are always a candidate, so the front can be compared against them
+	// Their key is built as a draw's is, so a draw of the defaults is not built twice
+	candidates.resize(1);
+	string defaults;
+	for (auto& param : TunedParams) {
+		candidates[0].params[param.first] = param.second[0];
+		defaults += param.second[0] + ",";
+	}
+	seen.push_back(defaults);
+	for (size_t attempt = 0; candidates.size() < numCandidates && attempt < 100 * numCandidates; attempt++) {
+		Candidate c;
+		string key;
+		for (auto& param : TunedParams) {
+			const string& value = param.second[generator() % param.second.size()];
+			c.params[param.first] = value;
+			key += value + ",";
+		}
+		if (find(seen.begin(), seen.end(), key) != seen.end()) continue;
+		seen.push_back(key);
+		candidates.push_back(move(c));
+	}
+}
+
+void ByteCutsTuner::BuildAll() {
+	atomic<size_t> next(0);
+	vector<thread> workers;
+	for (size_t t = 0; t < min(threads, candidates.size()); t++) {
+		workers.emplace_back([&]() {
+			for (size_t i = next++; i < candidates.size(); i = next++) {
+				Candidate& c = candidates[i];
+				unordered_map<string, string> config = args;
+				for (auto& pair : c.params) {
+					config[pair.first] = pair.second;
+				}
+				time_point<steady_clock> start = steady_clock::now();
+				c.classifier.reset(new ByteCutsClassifier(config));
+				c.classifier->ConstructClassifier(rules);
+				duration<double> elapsed = steady_clock::now() - start;
+				c.buildSeconds = elapsed.count();
+				c.bytes = c.classifier->MemSizeBytes();
+			}
+		});
+	}
+	for (thread& w : workers) {
+		w.join();
+	}
+}
+
+vector<int> ByteCutsTuner::Measure(Candidate& c, size_t numPackets) {
+	vector<int> results(numPackets);
+	// Best of three, so one descheduling does not eliminate a candidate
+	double best = numeric_limits<double>::max();
+	for (int rep = 0; rep < 3; rep++) {
+		time_point<steady_clock> start = steady_clock::now();
+		c.classifier->ClassifyPackets(sample.data(), numPackets, results.data());
+		duration<double> elapsed = steady_clock::now() - start;
+		best = min(best, elapsed.count());
+	}
+	c.mpps = numPackets / max(best, 1e-9) / 1e6;
+	c.rounds++;
+	return results;
+}
+
+vector<size_t> ByteCutsTuner::ParetoRanks(const vector<size_t>& set) const {
+	vector<size_t> ranks(set.size(), numeric_limits<size_t>::max());
+	size_t ranked = 0;
+	for (size_t rank = 0; ranked < set.size(); rank++) {
+		vector<size_t> front;
+		for (size_t i = 0; i < set.size(); i++) {
+			if (ranks[i] < rank) continue;
+			const Candidate& a = candidates[set[i]];
+			bool dominated = false;
+			for (size_t j = 0; j < set.size() && !dominated; j++) {
+				if (j == i || ranks[j] < rank) continue;
+				const Candidate& b = candidates[set[j]];
+				dominated = b.mpps >= a.mpps && b.bytes <= a.bytes && (b.mpps > a.mpps || b.bytes < a.bytes);
+			}
+			if (!dominated) {
+				front.push_back(i);
+			}
+		}
+		for (size_t i : front) {
+			ranks[i] = rank;
+		}
+		ranked += front.size();
+	}
+	return ranks;
+}
+
+void ByteCutsTuner::Run() {
+	printf("Tuning: building %lu candidates on %lu threads\n", candidates.size(), threads);
+	BuildAll();
+	
+	vector<size_t> alive(candidates.size());
+	iota(alive.begin(), alive.end(), 0);
+	size_t numRounds = 1;
+	for (size_t n = alive.size(); n > keep; n = (n + 1) / 2) {
+		numRounds++;
+	}
+	// The defaults classify the whole sample once, so every round's prefix has results to check against
+	vector<int> reference(sample.size());
+	candidates[0].classifier->ClassifyPackets(sample.data(), sample.size(), reference.data());
+	for (size_t round = 0; round < numRounds; round++) {
+		size_t numPackets = max<size_t>(min<size_t>(1000, sample.size()), sample.size() >> (numRounds - 1 - round));
+		for (size_t i : alive) {
+			vector<int> results = Measure(candidates[i], numPackets);
+			// Every round checks its longer prefix against the defaults; a candidate that disagrees is dropped
+			candidates[i].mismatches = inner_product(results.begin(), results.end(), reference.begin(), size_t(0), plus<size_t>(), not_equal_to<int>());
+		}
+		alive.erase(remove_if(alive.begin(), alive.end(), [&](size_t i) { return candidates[i].mismatches > 0; }), alive.end());
+		vector<size_t> ranks = ParetoRanks(alive);
+		printf("\tRound %lu: %lu candidates, %lu packets, %lu on the front\n", round, alive.size(), numPackets, (size_t)count(ranks.begin(), ranks.end(), 0));
+		if (round + 1 == numRounds) {
+			for (size_t k = 0; k < alive.size(); k++) {
+				candidates[alive[k]].pareto = ranks[k] == 0;
+			}
+			break;
+		}
+		
+		vector<size_t> order(alive.size());
+		iota(order.begin(), order.end(), 0);
+		sort(order.begin(), order.end(), [&](size_t x, size_t y) {
+			if (ranks[x] != ranks[y]) return ranks[x] < ranks[y];
+			return candidates[alive[x]].mpps > candidates[alive[y]].mpps;
+		});
+		vector<size_t> survivors;
+		for (size_t k = 0; k < order.size(); k++) {
+			if (k < max(keep, (alive.size() + 1) / 2)) {
+				survivors.push_back(alive[order[k]]);
+			} else {
+				candidates[alive[order[k]]].classifier.reset();
+			}
+		}
+		alive.swap(survivors);
+	}
+	for (Candidate& c : candidates) {
+		c.classifier.reset();
+	}
+}
+
+vector<string> ByteCutsTuner::Header() const {
+	vector<string> header = {"Candidate", "Pareto", "Rounds", "Mpps", "Memory", "Build", "Mismatches"};
+	for (auto& param : TunedParams) {
+		header.push_back(param.first);
+	}
+	return header;
+}
+
+vector<map<string, string>> ByteCutsTuner::Rows() const {
+	vector<map<string, string>> rows;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		const Candidate& c = candidates[i];
+		map<string, string> row(c.params.begin(), c.params.end());
+		row["Candidate"] = to_string(i);
+		row["Pareto"] = c.pareto ? "1" : "0";
+		row["Rounds"] = to_string(c.rounds);
+		row["Mpps"] = to_string(c.mpps);
+		row["Memory"] = to_string(c.bytes);
+		row["Build"] = to_string(c.buildSeconds);
+		row["Mismatches"] = to_string(c.mismatches);
+		rows.push_back(row);
+	}
+	return rows;
+}
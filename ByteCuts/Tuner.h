@@ -0,0 +1,76 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef BYTECUTS_TUNER_H
+#define BYTECUTS_TUNER_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ByteCuts.h"
+
+// Searches the BC.* construction parameters by successive halving
+// Every candidate is built once, in parallel. Each round times lookups on a prefix of the sample trace
+// that doubles from round to round, and keeps the better half by Pareto rank over throughput and memory
+class ByteCutsTuner {
+public:
+	struct Candidate {
+		std::unordered_map<std::string, std::string> params;
+		std::unique_ptr<ByteCutsClassifier> classifier;
+		double buildSeconds = 0;
+		Memory bytes = 0;
+		double mpps = 0;
+		size_t rounds = 0;
+		// Lookups that disagreed with the default configuration
+		size_t mismatches = 0;
+		bool pareto = false;
+	};
+
+	// Tune=<candidates>, Tune.Seed, Tune.Keep (survivors of the last round) and Threads are read from args;
+	// every other argument is passed through to each candidate
+	ByteCutsTuner(const std::unordered_map<std::string, std::string>& args, const std::vector<Rule>& rules, const std::vector<Packet>& sample);
+
+	void Run();
+	// One row per candidate: its parameters, measurements, and whether it is Pareto-best
+	std::vector<std::map<std::string, std::string>> Rows() const;
+	std::vector<std::string> Header() const;
+	const std::vector<Candidate>& Candidates() const { return candidates; }
+private:
+	void Sample(size_t numCandidates, unsigned seed);
+	void BuildAll();
+	std::vector<int> Measure(Candidate& c, size_t numPackets);
+	// Pareto rank of each candidate in the set: 0 for the non-dominated ones, 1 for those left once 0 is removed, ...
+	std::vector<size_t> ParetoRanks(const std::vector<size_t>& set) const;
+
+	std::unordered_map<std::string, std::string> args;
+	const std::vector<Rule>& rules;
+	const std::vector<Packet>& sample;
+	size_t keep;
+	size_t threads;
+	std::vector<Candidate> candidates;
+};
+
+#endif
@@ -23,18 +23,341 @@
  */
 #include "Common.h"
 
+#include "Baselines/HyperSplit.h"
+#include "Baselines/LinearSearch.h"
+#include "Baselines/TupleSpace.h"
 #include "ByteCuts/ByteCuts.h"
+#include "ByteCuts/Tuner.h"
+#include "ByteCuts/ClassifierHandle.h"
+#include "ByteCuts/NumaReplicas.h"
 #include "IO/InputReader.h"
 #include "IO/OutputWriter.h"
+#include "IO/PcapReader.h"
+#include "Utilities/HugePages.h"
+#include "Utilities/BuildProfiler.h"
 #include "Utilities/MapExtensions.h"
+#include "Utilities/Redundancy.h"
+#include "Utilities/SpscRing.h"
 #include "Utilities/VectorExtensions.h"
 
+#include <atomic>
+#include <functional>
+#include <limits>
 #include <map>
+#include <omp.h>
 #include <string>
+#include <thread>
 
 using namespace std;
 using namespace std::chrono;
 
+// Times ClassifyAllMatches against a linear scan of the sorted rules and checks that they agree
+void BenchmarkAllMatches(const ByteCutsClassifier& bc, const vector<Rule>& rules, const vector<Packet>& packets, size_t k, map<string, string>& data) {
+	time_point<steady_clock> start, end;
+	duration<double> elapsedSeconds;
+	vector<Rule> sorted = rules;
+	SortRules(sorted);
+	
+	vector<int> found(packets.size() * k);
+	vector<size_t> numFound(packets.size());
+	size_t totalMatches = 0;
+	start = steady_clock::now();
+	for (size_t i = 0; i < packets.size(); i++) {
+		numFound[i] = bc.ClassifyAllMatches(packets[i], found.data() + i * k, k);
+		totalMatches += numFound[i];
+	}
+	end = steady_clock::now();
+	elapsedSeconds = end - start;
+	double treeTime = elapsedSeconds.count();
+	
+	vector<int> expected(packets.size() * k);
+	vector<size_t> numExpected(packets.size());
+	start = steady_clock::now();
+	for (size_t i = 0; i < packets.size(); i++) {
+		size_t n = 0;
+		for (const Rule& r : sorted) {
+			if (r.MatchesPacket(packets[i])) {
+				expected[i * k + n++] = r.priority;
+				if (n == k) break;
+			}
+		}
+		numExpected[i] = n;
+	}
+	end = steady_clock::now();
+	elapsedSeconds = end - start;
+	double linearTime = elapsedSeconds.count();
+	
+	size_t mismatches = 0;
+	for (size_t i = 0; i < packets.size(); i++) {
+		if (numFound[i] != numExpected[i] || !equal(found.begin() + i * k, found.begin() + i * k + numFound[i], expected.begin() + i * k)) {
+			mismatches++;
+		}
+	}
+	
+	printf("\tAll matches (top %lu): %f ms, linear scan: %f ms, %lu matches, %lu mismatches\n", k, treeTime * 1000, linearTime * 1000, totalMatches, mismatches);
+	data["MultiMatch"] = to_string(treeTime);
+	data["MultiMatchLinear"] = to_string(linearTime);
+	data["MultiMatchCount"] = to_string(totalMatches);
+	data["MultiMatchMismatches"] = to_string(mismatches);
+}
+
+// Classifies the trace on several threads, each using the classifier chosen for it, and returns the seconds taken
+// Threads are pinned to nodes in turn before choosing, so a copy chosen by node stays local for the whole run
+template <class Chooser>
+double ClassifyInParallel(Chooser choose, const NumaReplicas& replicas, const vector<Packet>& packets, int* results, size_t numThreads) {
+	time_point<steady_clock> start = steady_clock::now();
+	#pragma omp parallel num_threads(numThreads)
+	{
+		NodePin pin(replicas.NodeOfThread(omp_get_thread_num()));
+		const ByteCutsClassifier& classifier = choose();
+		#pragma omp for schedule(static)
+		for (size_t i = 0; i < packets.size(); i++) {
+			results[i] = classifier.ClassifyAPacket(packets[i]);
+		}
+	}
+	duration<double> elapsed = steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Looks packets up on every thread while the classifier is rebuilt and republished in a loop
+// Any lookup that disagrees with the single-threaded results counts as a mismatch
+void StressHotSwap(const unordered_map<string, string>& args, const vector<Rule>& rules, const vector<Packet>& packets, const int* expected, double seconds, size_t numThreads, map<string, string>& data) {
+	ByteCutsClassifier* initial = new ByteCutsClassifier(args);
+	initial->ConstructClassifier(rules);
+	ClassifierHandle handle(initial, numThreads);
+	
+	atomic<bool> stop(false);
+	atomic<size_t> lookups(0);
+	atomic<size_t> mismatches(0);
+	vector<thread> readers;
+	for (size_t t = 0; t < numThreads; t++) {
+		readers.emplace_back([&]() {
+			size_t reader = handle.RegisterReader();
+			size_t i = (reader * packets.size()) / numThreads;
+			size_t n = 0, bad = 0;
+			while (!stop.load(memory_order_relaxed)) {
+				for (size_t j = 0; j < 1024; j++, n++) {
+					if (handle.ClassifyAPacket(reader, packets[i]) != expected[i]) {
+						bad++;
+					}
+					i = (i + 1) % packets.size();
+				}
+			}
+			lookups += n;
+			mismatches += bad;
+		});
+	}
+	
+	time_point<steady_clock> deadline = steady_clock::now() + duration_cast<steady_clock::duration>(duration<double>(seconds));
+	size_t rebuilds = 0;
+	while (steady_clock::now() < deadline) {
+		// Alternate layouts so that consecutive versions differ in memory
+		unordered_map<string, string> variant = args;
+		variant["BC.CompressCuts"] = (rebuilds % 2 == 0) ? "0" : "1";
+		ByteCutsClassifier* next = new ByteCutsClassifier(variant);
+		next->ConstructClassifier(rules);
+		handle.Publish(next);
+		rebuilds++;
+	}
+	stop = true;
+	for (thread& t : readers) {
+		t.join();
+	}
+	handle.Reclaim();
+	
+	printf("\tHot swap: %lu threads, %lu rebuilds, %lu lookups, %lu mismatches, %lu reclaimed, %lu pending\n", numThreads, rebuilds, lookups.load(), mismatches.load(), handle.NumReclaimed(), handle.NumPending());
+	data["HotSwapThreads"] = to_string(numThreads);
+	data["HotSwapRebuilds"] = to_string(rebuilds);
+	data["HotSwapLookups"] = to_string(lookups.load());
+	data["HotSwapMismatches"] = to_string(mismatches.load());
+}
+
+// RSS-style shard of a packet: a hash of its header fields picks the worker, so a flow stays on one core
+size_t ShardOf(const Packet p, size_t numShards) {
+	uint64_t h = 0;
+	for (size_t d = 0; d < NumDims; d++) {
+		h = (h ^ p[d]) * 0x9E3779B97F4A7C15ull;
+	}
+	return (h >> 32) % numShards;
+}
+
+// A reader thread shards the trace over SPSC rings to the classifier workers, and the calling
+// thread, as writer, collects results in trace order and returns the seconds taken
+// Each worker answers its shard in FIFO order, so the writer restores the order by popping
+// from the ring of each packet's shard in turn, with no reorder buffer
+double RunPipeline(const PacketClassifier& classifier, const vector<Packet>& packets, int* results, size_t numWorkers) {
+	const size_t RingSize = 1024;
+	const size_t End = numeric_limits<size_t>::max();
+	vector<unique_ptr<SpscRing<size_t>>> toWorkers;
+	vector<unique_ptr<SpscRing<int>>> fromWorkers;
+	for (size_t w = 0; w < numWorkers; w++) {
+		toWorkers.emplace_back(new SpscRing<size_t>(RingSize));
+		fromWorkers.emplace_back(new SpscRing<int>(RingSize));
+	}
+	
+	time_point<steady_clock> start = steady_clock::now();
+	vector<thread> stages;
+	stages.emplace_back([&]() {
+		for (size_t i = 0; i < packets.size(); i++) {
+			toWorkers[ShardOf(packets[i], numWorkers)]->Push(i);
+		}
+		for (auto& ring : toWorkers) {
+			ring->Push(End);
+		}
+	});
+	for (size_t w = 0; w < numWorkers; w++) {
+		stages.emplace_back([&, w]() {
+			SpscRing<size_t>& in = *toWorkers[w];
+			SpscRing<int>& out = *fromWorkers[w];
+			for (size_t i = in.Pop(); i != End; i = in.Pop()) {
+				out.Push(classifier.ClassifyAPacket(packets[i]));
+			}
+		});
+	}
+	for (size_t i = 0; i < packets.size(); i++) {
+		results[i] = fromWorkers[ShardOf(packets[i], numWorkers)]->Pop();
+	}
+	for (thread& t : stages) {
+		t.join();
+	}
+	duration<double> elapsed = steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Runs the pipeline with 1, 2, 4, ... up to maxWorkers classifier workers and records the Mpps of each
+void SweepPipeline(const PacketClassifier& classifier, const vector<Packet>& packets, const int* expected, size_t maxWorkers, map<string, string>& data) {
+	vector<size_t> workers;
+	for (size_t n = 1; n < maxWorkers; n *= 2) {
+		workers.push_back(n);
+	}
+	workers.push_back(maxWorkers);
+	
+	vector<int> piped(packets.size());
+	vector<string> mpps;
+	size_t mismatches = 0;
+	for (size_t n : workers) {
+		double seconds = RunPipeline(classifier, packets, piped.data(), n);
+		for (size_t i = 0; i < packets.size(); i++) {
+			if (piped[i] != expected[i]) mismatches++;
+		}
+		double rate = packets.size() / seconds / 1e6;
+		printf("\tPipeline: %lu workers, %.2f Mpps\n", n, rate);
+		mpps.push_back(to_string(rate));
+	}
+	printf("\tPipeline mismatches: %lu\n", mismatches);
+	data["PipelineWorkers"] = Join("-", workers);
+	data["PipelineMpps"] = Join("-", mpps);
+	data["PipelineMismatches"] = to_string(mismatches);
+}
+
+// Prints the ByteCuts memory breakdown and per-tree shape, and records them as statistics
+void ReportByteCuts(const ByteCutsClassifier& bc, map<string, string>& data) {
+	TreeStats memStats = bc.Stats();
+	printf("\t\tNodes: %lu B, Cut arrays: %lu B, Split arrays: %lu B, Leaf rules: %lu B\n", memStats.nodeBytes, memStats.cutArrayBytes, memStats.splitArrayBytes, memStats.leafRuleBytes);
+	printf("\t\tCut nodes: %lu (%lu compressed)\n", memStats.cutNodes, memStats.compressedCutNodes);
+	printf("\t\tChildren: %lu unique, %lu shared (%lu B of repeated pointers)\n", memStats.uniqueChildren, memStats.sharedChildren, memStats.sharedSlotBytes);
+	double skippedFields = memStats.leafFieldTests ? memStats.skippedFieldTests * 1.0 / memStats.leafFieldTests : 0;
+	double exactFields = memStats.leafFieldTests ? memStats.exactFieldTests * 1.0 / memStats.leafFieldTests : 0;
+	printf("\t\tLeaf field tests: %.2f%% skipped, %.2f%% single compares\n", 100 * skippedFields, 100 * exactFields);
+	printf("\tPeak build RSS: %.2f MiB above the resident set on entry\n", bc.PeakBuildRss() / (1024 * 1024.0));
+	data["NodeBytes"] = to_string(memStats.nodeBytes);
+	data["CutArrayBytes"] = to_string(memStats.cutArrayBytes);
+	data["SplitArrayBytes"] = to_string(memStats.splitArrayBytes);
+	data["LeafRuleBytes"] = to_string(memStats.leafRuleBytes);
+	data["SharedSlotBytes"] = to_string(memStats.sharedSlotBytes);
+	data["CompressedCuts"] = to_string(memStats.compressedCutNodes);
+	data["UniqueChildren"] = to_string(memStats.uniqueChildren);
+	data["SharedChildren"] = to_string(memStats.sharedChildren);
+	data["SkippedFields"] = to_string(skippedFields);
+	data["ExactFields"] = to_string(exactFields);
+	data["PeakBuildRSS"] = to_string(bc.PeakBuildRss());
+	data["BitVectorRules"] = to_string(bc.NumBitVectorRules());
+	data["BitVectorBytes"] = to_string(memStats.bitVectorBytes);
+	if (bc.Classes()) {
+		vector<size_t> numClasses;
+		for (size_t i = 0; i < bc.Classes()->NumTables(); i++) {
+			numClasses.push_back(bc.Classes()->NumClasses(i));
+		}
+		printf("\t\tClass tables: %lu B, classes: %s\n", memStats.classTableBytes, Join("-", numClasses).c_str());
+		data["ClassTableBytes"] = to_string(memStats.classTableBytes);
+		data["PortClasses"] = Join("-", numClasses);
+	}
+	if (bc.HasBudget()) {
+		const MemoryBudget& budget = bc.Budget();
+		printf("\tMemory budget: %lu B, estimated %lu B during build, %lu rules moved to the bit vector\n", budget.Limit(), budget.Used(), bc.NumOverBudgetRules());
+		data["MemBudget"] = to_string(budget.Limit());
+		data["BudgetEstimate"] = to_string(budget.Used());
+		data["OverBudgetRules"] = to_string(bc.NumOverBudgetRules());
+	}
+	if (bc.HasLookupBounds()) {
+		// Counted from the structures as built, so these hold for every packet
+		vector<size_t> treeLines;
+		for (size_t i = 0; i < bc.NumTables(); i++) {
+			treeLines.push_back(bc.LinesOfTree(i));
+		}
+		printf("\tGuaranteed per lookup: at most %lu structures, %lu cache lines (%lu trees merged into the bit vector)\n", bc.WorstCaseTrees(), bc.WorstCaseLines(), bc.NumMergedTrees());
+		if ((bc.TreeLimit() > 0 && bc.WorstCaseTrees() > bc.TreeLimit()) || (bc.AccessLimit() > 0 && bc.WorstCaseLines() > bc.AccessLimit())) {
+			printf("\tWarning: the requested lookup bounds could not be met\n");
+		}
+		data["WorstCaseTrees"] = to_string(bc.WorstCaseTrees());
+		data["WorstCaseLines"] = to_string(bc.WorstCaseLines());
+		data["MergedTrees"] = to_string(bc.NumMergedTrees());
+		data["TreeLines"] = Join("-", treeLines);
+	}
+	
+	int height = 0;
+	int maxHeight = 0;
+	int cost = 0;
+	int maxCost = 0;
+	int cacheLines = 0;
+	vector<int> heights;
+	vector<int> costs;
+	vector<int> priors;
+	vector<Memory> treeBytes;
+	for (size_t i = 0; i < bc.NumTables(); i++) {
+		TreeStats treeStats = bc.StatsOfTree(i);
+		int h = treeStats.height;
+		int c = treeStats.cost;
+		cacheLines += treeStats.cacheLines;
+		treeBytes.push_back(treeStats.TotalBytes());
+		printf("Height:  %d / %d\n", h, c);
+		height += h;
+		maxHeight = max(h, maxHeight);
+		cost += c;
+		maxCost = max(c, maxCost);
+		heights.push_back(h);
+		costs.push_back(c);
+		priors.push_back(bc.PriorityOfTable(i));
+	}
+	// Worst case over every tree, so the number of trees counts too
+	printf("\tEstimated cache lines per lookup: %d\n", cacheLines);
+	data["CacheLines"] = to_string(cacheLines);
+	data["MaxHeight"] = to_string(maxHeight);
+	data["SumHeight"] = to_string(height);
+	data["Heights"] = Join("-", heights);
+	data["MaxCost"] = to_string(maxCost);
+	data["SumCost"] = to_string(cost);
+	data["Costs"] = Join("-", costs);
+	data["Priors"] = Join("-", priors);
+	data["TreeBytes"] = Join("-", treeBytes);
+	
+	data["GoodTrees"] = to_string(bc.NumGoodTrees());
+	data["BadTrees"] = to_string(bc.NumBadTrees());
+}
+
+template <class Engine>
+PacketClassifier* MakeEngine(const unordered_map<string, string>& args) {
+	return new Engine(args);
+}
+
+// Engines selectable with Engine=<name>; all share the same input, timing and output path
+const map<string, function<PacketClassifier*(const unordered_map<string, string>&)>> Engines = {
+	{ "ByteCuts", MakeEngine<ByteCutsClassifier> },
+	{ "HyperSplit", MakeEngine<HyperSplitClassifier> },
+	{ "Linear", MakeEngine<LinearSearchClassifier> },
+	{ "TupleSpace", MakeEngine<TupleSpaceClassifier> },
+};
+
 int main(int argc, char* argv[]) {
 	printf("Hello, world.\n");
 	
@@ -44,82 +367,236 @@ int main(int argc, char* argv[]) {
 	string packetFile = args["Packets"];
 	string resultsFile = GetOrElse(args, "Results", "");
 	string statsFile = args["Stats"];
+	string engine = GetOrElse(args, "Engine", "ByteCuts");
+	string hugePages = GetOrElse(args, "HugePages", "Off");
+	
+	auto factory = Engines.find(engine);
+	if (factory == Engines.end()) {
+		printf("Unknown engine: %s\nEngines:", engine.c_str());
+		for (auto& pair : Engines) {
+			printf(" %s", pair.first.c_str());
+		}
+		printf("\n");
+		return EXIT_FAILURE;
+	}
 	
 	time_point<steady_clock> start, end;
 	duration<double> elapsedSeconds;
 	duration<double,std::milli> elapsedMilliseconds;
 	
 	map<string, string> data;
-	data["Name"] = "ByteCuts";
+	data["Name"] = engine;
 	
 	vector<Rule> rules = InputReader::ReadFilterFile(infile);
 	printf("%lu rules\n", rules.size());
-	vector<Packet> packets = InputReader::ReadPackets(packetFile);
+	bool removeRedundant = GetBoolOrElse(args, "RemoveRedundant", false);
+	if (removeRedundant) {
+		start = steady_clock::now();
+		RedundancyReport redundant = RemoveRedundantRules(rules);
+		elapsedMilliseconds = steady_clock::now() - start;
+		printf("Removed %lu redundant rules (%lu by one rule, %lu by a union, %lu undecided) in %f ms\n", redundant.Removed(), redundant.coveredBySingle, redundant.coveredByUnion, redundant.undecided, elapsedMilliseconds.count());
+		data["RedundantSingle"] = to_string(redundant.coveredBySingle);
+		data["RedundantUnion"] = to_string(redundant.coveredByUnion);
+		data["RedundantUndecided"] = to_string(redundant.undecided);
+	}
+	// With HugePages, the trace and the results are placed in huge pages along with the trees
+	unique_ptr<HugePageArena> packetArena;
+	if (hugePages != "Off") {
+		packetArena.reset(new HugePageArena(hugePages));
+	}
+	
+	vector<Packet> packets;
+	Point* capturePoints = nullptr;
+	if (PcapReader::IsCapture(packetFile)) {
+		// Captures are extracted straight into one contiguous buffer
+		PcapReader capture(packetFile);
+		size_t bound = capture.NumFrames() * NumDims;
+		capturePoints = packetArena ? packetArena->Allocate<Point>(bound) : new Point[bound];
+		size_t n = capture.Extract(capturePoints);
+		for (size_t j = 0; j < n; j++) {
+			packets.push_back(capturePoints + j * NumDims);
+		}
+		printf("%lu frames, %lu skipped (%lu truncated)\n", capture.NumFrames(), capture.NumSkipped(), capture.NumTruncated());
+		data["CaptureFrames"] = to_string(capture.NumFrames());
+		data["CaptureSkipped"] = to_string(capture.NumSkipped());
+	} else {
+		packets = InputReader::ReadPackets(packetFile);
+		if (packetArena) {
+			Point* points = packetArena->Allocate<Point>(packets.size() * NumDims);
+			for (size_t j = 0; j < packets.size(); j++) {
+				copy_n(packets[j], NumDims, points + j * NumDims);
+				delete [] packets[j];
+				packets[j] = points + j * NumDims;
+			}
+		}
+	}
 	printf("%lu packets\n", packets.size());
 	
-	printf("Constructing!\n");
+	// Tune=<candidates> searches the BC.* parameters on the trace instead of a single run
+	if (args.find("Tune") != args.end()) {
+		ByteCutsTuner tuner(args, rules, packets);
+		tuner.Run();
+		printf("Pareto-best configurations:\n");
+		for (auto& row : tuner.Rows()) {
+			if (row["Pareto"] != "1") continue;
+			printf("\t%s Mpps, %s B:", row["Mpps"].c_str(), row["Memory"].c_str());
+			for (auto& pair : tuner.Candidates()[stoul(row["Candidate"])].params) {
+				printf(" %s=%s", pair.first.c_str(), pair.second.c_str());
+			}
+			printf("\n");
+		}
+		OutputWriter::WriteCsvFile(statsFile, tuner.Header(), tuner.Rows());
+		if (capturePoints) {
+			if (!packetArena) delete [] capturePoints;
+		} else if (!packetArena) {
+			for (Packet p : packets) {
+				delete [] p;
+			}
+		}
+		return 0;
+	}
+	
+	unique_ptr<PacketClassifier> classifier(factory->second(args));
+	
+	// Previous=<rule file> first builds the classifier for that policy, then times only the update to Rules
+	string previousFile = GetOrElse(args, "Previous", "");
+	ByteCutsClassifier* updatable = dynamic_cast<ByteCutsClassifier*>(classifier.get());
+	if (!previousFile.empty() && !(updatable && updatable->CanUpdate())) {
+		printf("Previous needs Engine=ByteCuts without BC.PortClasses, MemBudget or lookup bounds; building from scratch\n");
+		previousFile.clear();
+	}
+	if (!previousFile.empty()) {
+		vector<Rule> previous = InputReader::ReadFilterFile(previousFile);
+		if (removeRedundant) {
+			RemoveRedundantRules(previous);
+		}
+		start = steady_clock::now();
+		updatable->ConstructClassifier(previous);
+		end = steady_clock::now();
+		elapsedMilliseconds = end - start;
+		elapsedSeconds = end - start;
+		printf("Constructed the previous %lu rules in %f ms\n", previous.size(), elapsedMilliseconds.count());
+		data["PreviousBuild"] = to_string(elapsedSeconds.count());
+	}
+	
+	// Profile=<file> records the construction phases, as a CSV or as folded stacks
+	string profileFile = GetOrElse(args, "Profile", "");
+	string profileFormat = GetOrElse(args, "ProfileFormat", "Csv");
+	BuildProfiler profiler;
+	if (!profileFile.empty()) {
+		BuildProfiler::Install(&profiler);
+	}
+	
+	printf("Constructing %s!\n", engine.c_str());
+	RuleUpdate update;
 	start = steady_clock::now();
-	//ByteCutsClassifier bc(args);
-	//SpanCutsClassifier bc(args);
-	ByteCutsClassifier bc(args);
-	bc.ConstructClassifier(rules);
-	//StepCuts sc(8);
-	//ByteCutsClassifier bc = sc.ConstructClassifier(rules);
+	if (!previousFile.empty()) {
+		update = updatable->Update(rules);
+	} else {
+		classifier->ConstructClassifier(rules);
+	}
 	
 	end = steady_clock::now();
+	BuildProfiler::Install(nullptr);
+	if (!profileFile.empty()) {
+		if (profileFormat == "Folded") {
+			profiler.WriteFolded(profileFile);
+		} else {
+			profiler.WriteCsv(profileFile);
+		}
+	}
 	elapsedMilliseconds = end - start;
 	elapsedSeconds = end - start;
 	printf("\tConstruction time: %f ms\n", elapsedMilliseconds.count());
 	data["Build"] = to_string(elapsedSeconds.count());
+	if (!previousFile.empty()) {
+		printf("\tUpdate: %lu rules added, %lu removed, %lu moved; %lu trees kept, %lu dropped, %lu built%s\n", update.added, update.removed, update.moved, update.keptTrees, update.droppedTrees, update.builtTrees, update.rebuiltBitVector ? ", bit vector rebuilt" : "");
+		data["RulesAdded"] = to_string(update.added);
+		data["RulesRemoved"] = to_string(update.removed);
+		data["RulesMoved"] = to_string(update.moved);
+		data["TreesKept"] = to_string(update.keptTrees);
+		data["TreesDropped"] = to_string(update.droppedTrees);
+		data["TreesBuilt"] = to_string(update.builtTrees);
+	}
 	
 	printf("Testing!\n");
-	int* results = new int[packets.size()];
-	int i = 0;
+	int* results = packetArena ? packetArena->Allocate<int>(packets.size()) : new int[packets.size()];
 	start = steady_clock::now();
-	for (Packet p : packets) {
-		results[i++] = bc.ClassifyAPacket(p);
-	}
+	classifier->ClassifyPackets(packets.data(), packets.size(), results);
 	end = steady_clock::now();
 	elapsedMilliseconds = end - start;
 	elapsedSeconds = end - start;
 	printf("\tClassification time: %f ms\n", elapsedMilliseconds.count());
 	data["Classify"] = to_string(elapsedSeconds.count());
 	
-	Memory memBytes = bc.MemSizeBytes();
-	printf("\tMemory: %d B\n", memBytes);
+	// The remaining modes exercise ByteCuts internals
+	const ByteCutsClassifier* bc = dynamic_cast<const ByteCutsClassifier*>(classifier.get());
+	size_t multiMatch = GetUIntOrElse(args, "MultiMatch", 0);
+	bool numa = GetBoolOrElse(args, "Numa", false);
+	double hotSwap = GetDoubleOrElse(args, "HotSwap", 0);
+	if (!bc && (multiMatch > 0 || numa || hotSwap > 0)) {
+		printf("MultiMatch, Numa and HotSwap need Engine=ByteCuts\n");
+		multiMatch = 0;
+		numa = false;
+		hotSwap = 0;
+	}
+	
+	if (multiMatch > 0) {
+		BenchmarkAllMatches(*bc, rules, packets, multiMatch, data);
+	}
+	
+	size_t threads = GetUIntOrElse(args, "Threads", max(1u, thread::hardware_concurrency()));
+	
+	if (numa) {
+		NumaReplicas replicas(*bc);
+		vector<int> parallelResults(packets.size());
+		double sharedTime = ClassifyInParallel([&]() -> const ByteCutsClassifier& { return *bc; }, replicas, packets, parallelResults.data(), threads);
+		double localTime = ClassifyInParallel([&]() -> const ByteCutsClassifier& { return replicas.Local(); }, replicas, packets, parallelResults.data(), threads);
+		size_t mismatches = 0;
+		for (size_t j = 0; j < packets.size(); j++) {
+			if (parallelResults[j] != results[j]) mismatches++;
+		}
+		double sharedMpps = packets.size() / sharedTime / 1e6;
+		double localMpps = packets.size() / localTime / 1e6;
+		printf("\tNUMA: %lu replicas, %lu threads, shared %.2f Mpps, node-local %.2f Mpps, %lu mismatches\n", replicas.NumReplicas(), threads, sharedMpps, localMpps, mismatches);
+		data["NumaReplicas"] = to_string(replicas.NumReplicas());
+		data["NumaThreads"] = to_string(threads);
+		data["SharedMpps"] = to_string(sharedMpps);
+		data["LocalMpps"] = to_string(localMpps);
+	}
+	
+	size_t pipeline = GetUIntOrElse(args, "Pipeline", 0);
+	if (pipeline > 0 && !packets.empty()) {
+		SweepPipeline(*classifier, packets, results, pipeline, data);
+	}
+	
+	if (hotSwap > 0 && !packets.empty()) {
+		StressHotSwap(args, rules, packets, results, hotSwap, threads, data);
+	}
+	
+	Memory memBytes = classifier->MemSizeBytes();
+	printf("\tMemory: %lu B\n", memBytes);
 	printf("\tMemory: %.2f MiB\n", memBytes / (1024 * 1024.0));
 	data["Memory"] = to_string(memBytes);
 	
-	printf("\tTrees: %lu\n", bc.NumTables());
-	data["Trees"] = to_string(bc.NumTables());
-	int height = 0;
-	int maxHeight = 0;
-	int cost = 0;
-	int maxCost = 0;
-	vector<int> heights;
-	vector<int> costs;
-	vector<int> priors;
-	for (size_t i = 0; i < bc.NumTables(); i++) {
-		int h = bc.HeightOfTree(i);
-		int c = bc.CostOfTree(i);
-		printf("Height:  %d / %d\n", h, c);
-		height += h;
-		maxHeight = max(h, maxHeight);
-		cost += c;
-		maxCost = max(c, maxCost);
-		heights.push_back(h);
-		costs.push_back(c);
-		priors.push_back(bc.PriorityOfTable(i));
+	printf("\tTrees: %lu\n", classifier->NumTables());
+	data["Trees"] = to_string(classifier->NumTables());
+	map<string, string> engineStats;
+	if (bc) {
+		ReportByteCuts(*bc, data);
+		if (bc->HasPrefilters()) {
+			double rejectRate = bc->PrefilterRejectRate(packets);
+			printf("\tPrefilters: %lu B, %.2f%% of tree visits rejected\n", bc->Stats().filterBytes, 100 * rejectRate);
+			data["PrefilterBytes"] = to_string(bc->Stats().filterBytes);
+			data["PrefilterRejects"] = to_string(rejectRate);
+		}
+	} else {
+		engineStats = classifier->EngineStats();
+		data.insert(engineStats.begin(), engineStats.end());
 	}
-	data["MaxHeight"] = to_string(maxHeight);
-	data["SumHeight"] = to_string(height);
-	data["Heights"] = Join("-", heights);
-	data["MaxCost"] = to_string(maxCost);
-	data["SumCost"] = to_string(cost);
-	data["Costs"] = Join("-", costs);
-	data["Priors"] = Join("-", priors);
 	
-	size_t firstSize = bc.RulesInTable(0);
+	// Lookup bounds may move every tree into the bit vector engine
+	size_t firstSize = classifier->NumTables() > 0 ? classifier->RulesInTable(0) : 0;
 	printf("\tRules In First Tree: %lu (%.2f%%)\n", firstSize, 100.0 * firstSize / rules.size());
 	data["FirstSize"] = to_string(1.0 * firstSize / rules.size());
 	
@@ -129,37 +606,95 @@ int main(int argc, char* argv[]) {
 	size_t rules95 = 0.95 * rules.size();
 	size_t rules99 = 0.99 * rules.size();
 	
-	while (rulesFound < rules90) {
-		rulesFound += bc.RulesInTable(numTables++);
+	while (rulesFound < rules90 && numTables < classifier->NumTables()) {
+		rulesFound += classifier->RulesInTable(numTables++);
 	}
 	data["Table90"] = to_string(numTables);
-	while (rulesFound < rules95) {
-		rulesFound += bc.RulesInTable(numTables++);
+	while (rulesFound < rules95 && numTables < classifier->NumTables()) {
+		rulesFound += classifier->RulesInTable(numTables++);
 	}
 	data["Table95"] = to_string(numTables);
-	while (rulesFound < rules99) {
-		rulesFound += bc.RulesInTable(numTables++);
+	while (rulesFound < rules99 && numTables < classifier->NumTables()) {
+		rulesFound += classifier->RulesInTable(numTables++);
 	}
 	data["Table99"] = to_string(numTables);
 	
-	data["GoodTrees"] = to_string(bc.NumGoodTrees());
-	data["BadTrees"] = to_string(bc.NumBadTrees());
-	
-	printf("Done testing: %d.\n", i);
+	printf("Done testing: %lu.\n", packets.size());
 	
 	if (!resultsFile.empty()) {
 		OutputWriter::WriteResults(resultsFile, results, packets.size());
 	}
 	
-	delete [] results;
-	for (Packet p : packets) {
-		delete [] p;
+	if (hugePages != "Off") {
+		string treeBacking = bc ? bc->TreeBacking() : "heap";
+		printf("\tPage backing: trees %s, packets %s\n", treeBacking.c_str(), packetArena->Backing().c_str());
+		data["HugePages"] = hugePages;
+		data["TreeBacking"] = treeBacking;
+		data["PacketBacking"] = packetArena->Backing();
+	}
+	
+	if (!packetArena) {
+		delete [] results;
+		if (capturePoints) {
+			delete [] capturePoints;
+		} else {
+			for (Packet p : packets) {
+				delete [] p;
+			}
+		}
 	}
 	
 	
 	
 	printf("Writing statistics\n");
-	vector<string> header = {"Name", "Build", "Classify", "Memory", "MaxHeight", "SumHeight", "MaxCost", "SumCost", "Trees", "FirstSize", "Table90", "Table95", "Table99", "Heights", "Costs", "Priors", "BadTrees", "GoodTrees"};
+	vector<string> header;
+	if (bc) {
+		header = {"Name", "Build", "Classify", "Memory", "MaxHeight", "SumHeight", "MaxCost", "SumCost", "Trees", "FirstSize", "Table90", "Table95", "Table99", "Heights", "Costs", "Priors", "BadTrees", "GoodTrees", "TreeBytes", "NodeBytes", "CutArrayBytes", "SplitArrayBytes", "LeafRuleBytes", "SharedSlotBytes", "CompressedCuts", "UniqueChildren", "SharedChildren", "PeakBuildRSS", "CacheLines", "SkippedFields", "ExactFields"};
+		if (bc->NumBitVectorRules() > 0) {
+			header.insert(header.end(), {"BitVectorRules", "BitVectorBytes"});
+		}
+		if (bc->Classes()) {
+			header.insert(header.end(), {"ClassTableBytes", "PortClasses"});
+		}
+		if (bc->HasPrefilters()) {
+			header.insert(header.end(), {"PrefilterBytes", "PrefilterRejects"});
+		}
+		if (bc->HasBudget()) {
+			header.insert(header.end(), {"MemBudget", "BudgetEstimate", "OverBudgetRules"});
+		}
+		if (bc->HasLookupBounds()) {
+			header.insert(header.end(), {"WorstCaseTrees", "WorstCaseLines", "MergedTrees", "TreeLines"});
+		}
+		if (!previousFile.empty()) {
+			header.insert(header.end(), {"PreviousBuild", "RulesAdded", "RulesRemoved", "RulesMoved", "TreesKept", "TreesDropped", "TreesBuilt"});
+		}
+	} else {
+		header = {"Name", "Build", "Classify", "Memory", "Trees", "FirstSize", "Table90", "Table95", "Table99"};
+		for (auto& pair : engineStats) {
+			header.push_back(pair.first);
+		}
+	}
+	if (pipeline > 0 && !packets.empty()) {
+		header.insert(header.end(), {"PipelineWorkers", "PipelineMpps", "PipelineMismatches"});
+	}
+	if (removeRedundant) {
+		header.insert(header.end(), {"RedundantSingle", "RedundantUnion", "RedundantUndecided"});
+	}
+	if (capturePoints) {
+		header.insert(header.end(), {"CaptureFrames", "CaptureSkipped"});
+	}
+	if (hugePages != "Off") {
+		header.insert(header.end(), {"HugePages", "TreeBacking", "PacketBacking"});
+	}
+	if (multiMatch > 0) {
+		header.insert(header.end(), {"MultiMatch", "MultiMatchLinear", "MultiMatchCount", "MultiMatchMismatches"});
+	}
+	if (numa) {
+		header.insert(header.end(), {"NumaReplicas", "NumaThreads", "SharedMpps", "LocalMpps"});
+	}
+	if (hotSwap > 0 && !packets.empty()) {
+		header.insert(header.end(), {"HotSwapThreads", "HotSwapRebuilds", "HotSwapLookups", "HotSwapMismatches"});
+	}
 	vector<map<string, string>> multidata = {data};
 	OutputWriter::WriteCsvFile(statsFile, header, multidata);
 	
@@ -35,14 +35,24 @@
 #include <memory>
 #include <chrono> 
 #include <array>
+#include <map>
+#include <string>
+
+// Building with -DIPV6 splits each 128-bit address into four 32-bit words,
+// each classified as its own dimension; the IPv4 layout is unchanged
+#ifdef IPV6
+#define WordsPerAddress 4
+#else
+#define WordsPerAddress 1
+#endif
 
-#define NumDims 5
+#define NumDims (2 * WordsPerAddress + 3)
 
 #define FieldSA 0
-#define FieldDA 1
-#define FieldSP 2
-#define FieldDP 3
-#define FieldProto 4
+#define FieldDA WordsPerAddress
+#define FieldSP (2 * WordsPerAddress)
+#define FieldDP (FieldSP + 1)
+#define FieldProto (FieldSP + 2)
 
 #define LowDim 0
 #define HighDim 1
@@ -52,7 +62,12 @@
 typedef uint32_t Point;
 typedef Point* Packet;
 
-typedef uint32_t Memory;
+// Largest value a packet carries in a dimension: 32-bit address words, 16-bit ports and an 8-bit protocol
+inline Point HeaderMax(size_t dim) {
+	return dim == FieldProto ? 0xFF : (dim == FieldSP || dim == FieldDP) ? 0xFFFF : 0xFFFFFFFF;
+}
+
+typedef uint64_t Memory;
 
 struct Interval {
 	Point low;
@@ -134,6 +149,29 @@ private:
 	static std::mt19937 generator;
 };
 
+// Interface shared by every engine that main can construct and time
+class PacketClassifier {
+public:
+	virtual ~PacketClassifier() {}
+	
+	virtual void ConstructClassifier(const std::vector<Rule>& rules) = 0;
+	virtual int ClassifyAPacket(const Packet& packet) const = 0;
+	// Classifies n packets into results; engines override it to avoid a virtual call per packet
+	virtual void ClassifyPackets(const Packet* packets, size_t n, int* results) const {
+		for (size_t i = 0; i < n; i++) {
+			results[i] = ClassifyAPacket(packets[i]);
+		}
+	}
+	
+	virtual Memory MemSizeBytes() const = 0;
+	virtual size_t NumTables() const = 0;
+	virtual size_t RulesInTable(size_t tableIndex) const = 0;
+	// Engine-specific columns for the statistics file
+	virtual std::map<std::string, std::string> EngineStats() const {
+		return {};
+	}
+};
+
 inline void SortRules(std::vector<Rule>& rules) {
 	sort(rules.begin(), rules.end(), [](const Rule& rx, const Rule& ry) { return rx.priority > ry.priority; });
 }
@@ -33,6 +33,7 @@
 #include <functional>
 #include "InputReader.h"
 #include <regex>
+#include <arpa/inet.h>
 
 using namespace std;
 
@@ -77,9 +78,18 @@ vector<Packet> InputReader::ReadPackets(const string& filename) {
 		istringstream iss(content);
 		vector<string> tokens{ istream_iterator < string > {iss}, istream_iterator < string > {} };
 		Packet one_packet = new Point[NumDims];
+#ifdef IPV6
+		// Addresses are given in text form, the remaining fields as integers
+		ReadIPv6Address(one_packet + FieldSA, tokens[0]);
+		ReadIPv6Address(one_packet + FieldDA, tokens[1]);
+		for (int i = FieldSP; i < NumDims; i++) {
+			one_packet[i] = atoui(tokens[i - FieldSP + 2]);
+		}
+#else
 		for (int i = 0; i < NumDims; i++) {
 			one_packet[i] = atoui(tokens[i]);
 		}
+#endif
 		packets.push_back(one_packet);
 		line_number++;
 	}
@@ -146,6 +156,44 @@ void InputReader::ReadIPRange(Interval& ipRange,  unsigned int& prefix_length, c
 	ipRange.high <<= 8;
 	ipRange.high += ptrange[3];
 }
+void InputReader::ReadIPv6Address(Point* words, const string& token)
+{
+	unsigned char bytes[16];
+	if (inet_pton(AF_INET6, token.c_str(), bytes) != 1) {
+		printf("ERROR: NOT A VALID IPV6 ADDRESS %s\n", token.c_str());
+		exit(1);
+	}
+	for (int w = 0; w < 4; w++) {
+		words[w] = (bytes[4 * w] << 24) | (bytes[4 * w + 1] << 16) | (bytes[4 * w + 2] << 8) | bytes[4 * w + 3];
+	}
+}
+
+void InputReader::ReadIPv6Range(Interval* ipRange, unsigned int* prefix_length, const string& token)
+{
+	// Example : 2001:db8::/32
+	// A prefix is a box over the four address words: exact words, one partial word, then wildcards
+	vector<string> split_slash = split(token, '/');
+	Point words[4];
+	ReadIPv6Address(words, split_slash[0]);
+	int mask = atoui(split_slash[1]);
+	for (int w = 0; w < 4; w++) {
+		int bits = min(max(mask - 32 * w, 0), 32);
+		Point keep = bits == 0 ? 0 : 0xFFFFFFFFu << (32 - bits);
+		ipRange[w].low = words[w] & keep;
+		ipRange[w].high = ipRange[w].low | ~keep;
+		prefix_length[w] = bits;
+	}
+}
+
+void InputReader::ReadAddress(Rule& rule, int field, const string& token)
+{
+#ifdef IPV6
+	ReadIPv6Range(rule.range + field, rule.prefix_length + field, token);
+#else
+	ReadIPRange(rule.range[field], rule.prefix_length[field], token);
+#endif
+}
+
 void InputReader::ReadPort(Interval& portRange, unsigned int& prefix_length, const string& from, const string& to)
 {
 	portRange.low = atoui(from);
@@ -193,15 +241,15 @@ int InputReader::ReadFilter(vector<string>& tokens, vector<Rule>& ruleset, unsig
 		/* reading SIP range */
 		if (i == 0) {
 
-			ReadIPRange(temp_rule.range[i], temp_rule.prefix_length[i], tokens[index_token++].substr(1));
-			i++;
+			ReadAddress(temp_rule, i, tokens[index_token++].substr(1));
+			i += WordsPerAddress;
 		} else {
-			ReadIPRange(temp_rule.range[i], temp_rule.prefix_length[i], tokens[index_token++]);
-			i++;
+			ReadAddress(temp_rule, i, tokens[index_token++]);
+			i += WordsPerAddress;
 		}
 		/* reading DIP range */
-		ReadIPRange(temp_rule.range[i], temp_rule.prefix_length[i], tokens[index_token++]);
-		i++;
+		ReadAddress(temp_rule, i, tokens[index_token++]);
+		i += WordsPerAddress;
 		ReadPort(temp_rule.range[i++], temp_rule.prefix_length[i], tokens[index_token], tokens[index_token + 2]);
 		index_token += 3;
 		ReadPort(temp_rule.range[i++], temp_rule.prefix_length[i], tokens[index_token], tokens[index_token + 2]);
@@ -45,6 +45,9 @@ private:
 
 //	static void ReadIPRange(vector<unsigned int>& IPrange, const string& token);
 	static void ReadIPRange(Interval& IPrange, unsigned int& prefix_length, const std::string& token);
+	static void ReadIPv6Address(Point* words, const std::string& token);
+	static void ReadIPv6Range(Interval* IPrange, unsigned int* prefix_length, const std::string& token);
+	static void ReadAddress(Rule& rule, int field, const std::string& token);
 	static void ReadPort(Interval& Portrange, unsigned int& prefix_length, const std::string& from, const std::string& to);
 	static void ReadProtocol(Interval& Protocol, unsigned int& prefix_length, const std::string& last_token);
 	static void ParseRange(Interval& range, const std::string& text);
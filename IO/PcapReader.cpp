@@ -0,0 +1,333 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "PcapReader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define PcapMagic 0xA1B2C3D4u
+#define PcapNanoMagic 0xA1B23C4Du
+#define PcapngSectionBlock 0x0A0D0D0Au
+#define PcapngByteOrderMagic 0x1A2B3C4Du
+#define PcapngInterfaceBlock 1
+#define PcapngSimplePacketBlock 3
+#define PcapngEnhancedPacketBlock 6
+
+#define LinkEthernet 1
+#define LinkRaw 101
+#define LinkLinuxSll 113
+
+#define EtherIPv4 0x0800
+#define EtherIPv6 0x86DD
+
+static inline uint16_t Net16(const uint8_t* p) {
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t Net32(const uint8_t* p) {
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline uint32_t Host32(const uint8_t* p) {
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+bool PcapReader::IsCapture(const string& filename) {
+	FILE* f = fopen(filename.c_str(), "rb");
+	if (!f) return false;
+	uint8_t magic[4];
+	bool read = fread(magic, 1, sizeof(magic), f) == sizeof(magic);
+	fclose(f);
+	if (!read) return false;
+	uint32_t m = Host32(magic);
+	for (uint32_t known : {PcapMagic, PcapNanoMagic, PcapngSectionBlock}) {
+		if (m == known || m == __builtin_bswap32(known)) return true;
+	}
+	return false;
+}
+
+PcapReader::PcapReader(const string& filename) : filename(filename) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) != 0) {
+		printf("Couldnt open capture file %s\n", filename.c_str());
+		exit(1);
+	}
+	printf("Reading capture file %s\n", filename.c_str());
+	fileSize = info.st_size;
+	if (fileSize > 0) {
+		void* map = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			printf("Couldnt map capture file %s\n", filename.c_str());
+			exit(1);
+		}
+		madvise(map, fileSize, MADV_SEQUENTIAL);
+		file = static_cast<const uint8_t*>(map);
+	}
+	close(fd);
+	
+	if (!ForEachFrame([this](const Frame&) { numFrames++; })) {
+		printf("Malformed capture file %s\n", filename.c_str());
+		exit(1);
+	}
+	if (partialTail) {
+		printf("Capture file %s ends in a partial record\n", filename.c_str());
+	}
+}
+
+PcapReader::~PcapReader() {
+	if (file) {
+		munmap(const_cast<uint8_t*>(file), fileSize);
+	}
+}
+
+size_t PcapReader::Extract(Point* out) {
+	size_t n = 0;
+	skipped = 0;
+	truncated = 0;
+	ForEachFrame([&](const Frame& frame) {
+		if (ParseFrame(frame, out + n * NumDims)) {
+			n++;
+		} else {
+			skipped++;
+		}
+	});
+	return n;
+}
+
+uint16_t PcapReader::File16(const uint8_t* p) const {
+	uint16_t x;
+	memcpy(&x, p, sizeof(x));
+	return swapped ? __builtin_bswap16(x) : x;
+}
+
+uint32_t PcapReader::File32(const uint8_t* p) const {
+	uint32_t x = Host32(p);
+	return swapped ? __builtin_bswap32(x) : x;
+}
+
+template <class Visit>
+bool PcapReader::ForEachFrame(Visit visit) {
+	if (fileSize < 4) return false;
+	uint32_t m = Host32(file);
+	if (m == PcapngSectionBlock || m == __builtin_bswap32(PcapngSectionBlock)) {
+		return ForEachPcapngFrame(visit);
+	}
+	return ForEachPcapFrame(visit);
+}
+
+template <class Visit>
+bool PcapReader::ForEachPcapFrame(Visit visit) {
+	const size_t FileHeader = 24, RecordHeader = 16;
+	if (fileSize < FileHeader) return false;
+	uint32_t m = Host32(file);
+	swapped = m != PcapMagic && m != PcapNanoMagic;
+	uint32_t linkType = File32(file + 20) & 0xFFFF;
+	
+	for (size_t pos = FileHeader; pos < fileSize; ) {
+		// A capture cut off mid-record, as left by an interrupted capture, ends at the last whole record
+		if (fileSize - pos < RecordHeader || fileSize - pos - RecordHeader < File32(file + pos + 8)) {
+			partialTail = true;
+			break;
+		}
+		size_t length = File32(file + pos + 8);
+		pos += RecordHeader;
+		visit(Frame{file + pos, length, linkType});
+		pos += length;
+	}
+	return true;
+}
+
+template <class Visit>
+bool PcapReader::ForEachPcapngFrame(Visit visit) {
+	const size_t BlockOverhead = 12;
+	vector<uint32_t> linkTypes;
+	for (size_t pos = 0; pos < fileSize; ) {
+		const uint8_t* block = file + pos;
+		if (fileSize - pos < BlockOverhead) {
+			partialTail = true;
+			break;
+		}
+		if (Host32(block) == PcapngSectionBlock) {
+			// Each section states its own byte order, and starts a new list of interfaces
+			swapped = Host32(block + 8) != PcapngByteOrderMagic;
+			linkTypes.clear();
+		}
+		uint32_t type = File32(block);
+		size_t length = File32(block + 4);
+		if (fileSize - pos < length) {
+			partialTail = true;
+			break;
+		}
+		if (length < BlockOverhead || length % 4 != 0) return false;
+		const uint8_t* body = block + 8;
+		size_t bodyLength = length - BlockOverhead;
+		
+		if (type == PcapngInterfaceBlock && bodyLength >= 2) {
+			linkTypes.push_back(File16(body));
+		} else if (type == PcapngEnhancedPacketBlock && bodyLength >= 20) {
+			uint32_t interface = File32(body);
+			size_t captured = File32(body + 12);
+			if (interface >= linkTypes.size() || captured > bodyLength - 20) return false;
+			visit(Frame{body + 20, captured, linkTypes[interface]});
+		} else if (type == PcapngSimplePacketBlock && bodyLength >= 4) {
+			if (linkTypes.empty()) return false;
+			size_t captured = min<size_t>(File32(body), bodyLength - 4);
+			visit(Frame{body + 4, captured, linkTypes[0]});
+		}
+		pos += length;
+	}
+	return true;
+}
+
+bool PcapReader::ParseFrame(const Frame& frame, Point* out) {
+	const uint8_t* data = frame.data;
+	size_t length = frame.length;
+	uint16_t etherType;
+	switch (frame.linkType) {
+	case LinkEthernet:
+		if (length < 14) {
+			truncated++;
+			return false;
+		}
+		etherType = Net16(data + 12);
+		data += 14;
+		length -= 14;
+		// 802.1Q, 802.1ad and legacy QinQ tags
+		while (etherType == 0x8100 || etherType == 0x88A8 || etherType == 0x9100) {
+			if (length < 4) {
+				truncated++;
+				return false;
+			}
+			etherType = Net16(data + 2);
+			data += 4;
+			length -= 4;
+		}
+		break;
+	case LinkLinuxSll:
+		if (length < 16) {
+			truncated++;
+			return false;
+		}
+		etherType = Net16(data + 14);
+		data += 16;
+		length -= 16;
+		break;
+	case LinkRaw:
+		if (length < 1) {
+			truncated++;
+			return false;
+		}
+		etherType = (data[0] >> 4) == 6 ? EtherIPv6 : EtherIPv4;
+		break;
+	default:
+		return false;
+	}
+	return ParseNetwork(data, length, etherType, out);
+}
+
+bool PcapReader::ParseNetwork(const uint8_t* data, size_t length, uint16_t etherType, Point* out) {
+#ifdef IPV6
+	if (etherType != EtherIPv6) return false;
+	if (length < 40 || (data[0] >> 4) != 6) {
+		truncated++;
+		return false;
+	}
+	for (int w = 0; w < 4; w++) {
+		out[FieldSA + w] = Net32(data + 8 + 4 * w);
+		out[FieldDA + w] = Net32(data + 24 + 4 * w);
+	}
+	uint8_t next = data[6];
+	bool firstFragment = true;
+	data += 40;
+	length -= 40;
+	// Walk the extension headers to the transport header
+	while (next == 0 || next == 43 || next == 44 || next == 51 || next == 60) {
+		if (length < 8) {
+			truncated++;
+			return false;
+		}
+		size_t headerLength;
+		if (next == 44) {
+			firstFragment = (Net16(data + 2) >> 3) == 0;
+			headerLength = 8;
+		} else if (next == 51) {
+			headerLength = (data[1] + 2) * 4;
+		} else {
+			headerLength = (data[1] + 1) * 8;
+		}
+		if (length < headerLength) {
+			truncated++;
+			return false;
+		}
+		next = data[0];
+		data += headerLength;
+		length -= headerLength;
+	}
+#else
+	if (etherType != EtherIPv4) return false;
+	if (length < 20 || (data[0] >> 4) != 4 || (data[0] & 0xF) < 5) {
+		truncated++;
+		return false;
+	}
+	size_t headerLength = (data[0] & 0xF) * 4;
+	if (length < headerLength) {
+		truncated++;
+		return false;
+	}
+	out[FieldSA] = Net32(data + 12);
+	out[FieldDA] = Net32(data + 16);
+	uint8_t next = data[9];
+	bool firstFragment = (Net16(data + 6) & 0x1FFF) == 0;
+	data += headerLength;
+	length -= headerLength;
+#endif
+	// Only the first fragment of a TCP or UDP datagram carries ports
+	if (firstFragment && (next == 6 || next == 17) && length < 4) {
+		truncated++;
+		return false;
+	}
+	ParseTransport(data, length, next, firstFragment, out);
+	return true;
+}
+
+void PcapReader::ParseTransport(const uint8_t* data, size_t length, uint8_t proto, bool firstFragment, Point* out) {
+	out[FieldProto] = proto;
+	if (firstFragment && (proto == 6 || proto == 17) && length >= 4) {
+		out[FieldSP] = Net16(data);
+		out[FieldDP] = Net16(data + 2);
+	} else {
+		out[FieldSP] = 0;
+		out[FieldDP] = 0;
+	}
+}
@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <string>
+#include "../Common.h"
+
+// Reads a pcap or pcapng capture in place through a read-only mapping
+// Frames are walked down to the transport header and their 5-tuple is written straight into a
+// caller-provided buffer of NumDims points per packet, so no frame is copied or allocated
+// The IPv4 build extracts IPv4 packets and the IPv6 build IPv6 packets; every other frame is skipped
+class PcapReader {
+public:
+	// True when the file starts with a pcap or pcapng magic number
+	static bool IsCapture(const std::string& filename);
+
+	explicit PcapReader(const std::string& filename);
+	PcapReader(const PcapReader&) = delete;
+	PcapReader& operator=(const PcapReader&) = delete;
+	~PcapReader();
+
+	// Number of frame records in the capture, an upper bound on the packets Extract writes
+	size_t NumFrames() const { return numFrames; }
+	// Writes NumDims points per extracted packet to out and returns the number of packets
+	size_t Extract(Point* out);
+
+	size_t NumSkipped() const { return skipped; }
+	size_t NumTruncated() const { return truncated; }
+private:
+	struct Frame {
+		const uint8_t* data;
+		size_t length;
+		uint32_t linkType;
+	};
+
+	// Calls visit on every frame record; returns false if the file is malformed
+	template <class Visit>
+	bool ForEachFrame(Visit visit);
+	template <class Visit>
+	bool ForEachPcapFrame(Visit visit);
+	template <class Visit>
+	bool ForEachPcapngFrame(Visit visit);
+
+	bool ParseFrame(const Frame& frame, Point* out);
+	bool ParseNetwork(const uint8_t* data, size_t length, uint16_t etherType, Point* out);
+	void ParseTransport(const uint8_t* data, size_t length, uint8_t proto, bool firstFragment, Point* out);
+
+	uint16_t File16(const uint8_t* p) const;
+	uint32_t File32(const uint8_t* p) const;
+
+	std::string filename;
+	const uint8_t* file = nullptr;
+	size_t fileSize = 0;
+	bool swapped = false;
+	bool partialTail = false;
+	size_t numFrames = 0;
+	size_t skipped = 0;
+	size_t truncated = 0;
+};
+
+#endif
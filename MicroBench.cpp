@@ -0,0 +1,376 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "Common.h"
+#include "IO/InputReader.h"
+#include "IO/OutputWriter.h"
+#include "Utilities/MapExtensions.h"
+#include "ByteCuts/ByteCutsNode.h"
+#include "ByteCuts/TreeBuilder.h"
+
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+
+// Operations per sample for the cheap kernels, so that each sample is long enough to time
+#define OpsPerSample (1 << 20)
+
+// Accumulates kernel results so that the timed work cannot be optimised away
+static volatile size_t sink;
+
+struct Measurement {
+	string kernel;
+	size_t size;
+	size_t ops;
+	vector<double> nsPerOp;
+};
+
+class MicroBench {
+public:
+	MicroBench(unsigned int numSamples, const string& filter) : numSamples(numSamples), filter(filter) {}
+
+	// Runs the kernel once to warm up and then once per sample; each run performs ops operations and returns a checksum
+	template <class Kernel>
+	void Time(const string& kernel, size_t size, size_t ops, Kernel run) {
+		if (kernel.find(filter) == string::npos) return;
+		Measurement m{kernel, size, ops, {}};
+		sink += run();
+		for (unsigned int s = 0; s < numSamples; s++) {
+			time_point<steady_clock> start = steady_clock::now();
+			sink += run();
+			time_point<steady_clock> end = steady_clock::now();
+			m.nsPerOp.push_back(duration<double, nano>(end - start).count() / ops);
+		}
+		map<string, string> row = Summarise(m);
+		printf("%-14s %6lu %12s ns/op  stdev %10s  min %12s\n", kernel.c_str(), size, row["MeanNs"].c_str(), row["StdevNs"].c_str(), row["MinNs"].c_str());
+		rows.push_back(row);
+	}
+
+	vector<string> Header() const {
+		return {"Kernel", "Size", "Ops", "Samples", "MeanNs", "StdevNs", "MinNs", "MedianNs"};
+	}
+	const vector<map<string, string>>& Rows() const { return rows; }
+private:
+	map<string, string> Summarise(Measurement& m) const {
+		size_t n = m.nsPerOp.size();
+		double mean = accumulate(m.nsPerOp.begin(), m.nsPerOp.end(), 0.0) / n;
+		double squares = 0;
+		for (double x : m.nsPerOp) {
+			squares += (x - mean) * (x - mean);
+		}
+		double stdev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+		sort(m.nsPerOp.begin(), m.nsPerOp.end());
+		double median = n % 2 ? m.nsPerOp[n / 2] : (m.nsPerOp[n / 2 - 1] + m.nsPerOp[n / 2]) / 2;
+
+		map<string, string> row;
+		row["Kernel"] = m.kernel;
+		row["Size"] = to_string(m.size);
+		row["Ops"] = to_string(m.ops);
+		row["Samples"] = to_string(n);
+		row["MeanNs"] = Format(mean);
+		row["StdevNs"] = Format(stdev);
+		row["MinNs"] = Format(m.nsPerOp.front());
+		row["MedianNs"] = Format(median);
+		return row;
+	}
+	static string Format(double ns) {
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.3f", ns);
+		return buffer;
+	}
+
+	unsigned int numSamples;
+	string filter;
+	vector<map<string, string>> rows;
+};
+
+Interval PrefixRange(Point value, unsigned int length) {
+	Point mask = length == 0 ? 0 : 0xFFFFFFFFu << (BitsPerField - length);
+	return Interval{value & mask, (value & mask) | ~mask};
+}
+
+// ClassBench-like rules: addresses drawn from a few networks with mostly long prefixes,
+// mostly wildcard source ports, destination ports that are exact, high or wildcard, and TCP or UDP
+vector<Rule> GenerateRules(size_t n, mt19937& generator) {
+	const unsigned int prefixLengths[] = {0, 8, 16, 24, 32};
+	discrete_distribution<int> prefixLength{1, 1, 2, 3, 5};
+	discrete_distribution<int> portKind{6, 2, 3};
+	discrete_distribution<int> protoKind{6, 3, 1};
+	const Point ports[] = {22, 25, 53, 80, 123, 443, 1521, 3306, 5060, 8080};
+	uniform_int_distribution<Point> word;
+	uniform_int_distribution<int> network(0, 15);
+	uniform_int_distribution<int> port(0, 9);
+
+	vector<Rule> rules(n);
+	for (size_t i = 0; i < n; i++) {
+		Rule& r = rules[i];
+		r.priority = n - 1 - i;
+		for (int field : {FieldSA, FieldDA}) {
+			unsigned int length = prefixLengths[prefixLength(generator)];
+			Point value = (Point(network(generator)) << 28) | (word(generator) >> 4);
+			r.range[field] = PrefixRange(value, length);
+			r.prefix_length[field] = length;
+		}
+		r.range[FieldSP] = Interval{0, 65535};
+		r.prefix_length[FieldSP] = 16;
+		switch (portKind(generator)) {
+			case 0:
+				{
+					Point p = ports[port(generator)];
+					r.range[FieldDP] = Interval{p, p};
+				}
+				break;
+			case 1:
+				r.range[FieldDP] = Interval{1024, 65535};
+				break;
+			default:
+				r.range[FieldDP] = Interval{0, 65535};
+		}
+		r.prefix_length[FieldDP] = 16;
+		switch (protoKind(generator)) {
+			case 0:
+				r.range[FieldProto] = Interval{6, 6};
+				break;
+			case 1:
+				r.range[FieldProto] = Interval{17, 17};
+				break;
+			default:
+				r.range[FieldProto] = Interval{0, 255};
+		}
+		r.prefix_length[FieldProto] = r.range[FieldProto].low == r.range[FieldProto].high ? 32 : 24;
+	}
+	return rules;
+}
+
+// Half the packets fall inside a random rule, the rest are uniform over every field
+vector<Point> GeneratePackets(const vector<Rule>& rules, size_t n, mt19937& generator) {
+	uniform_int_distribution<size_t> pick(0, rules.size() - 1);
+	uniform_int_distribution<Point> word;
+	vector<Point> points(n * NumDims);
+	for (size_t i = 0; i < n; i++) {
+		Point* p = points.data() + i * NumDims;
+		if (i % 2 == 0) {
+			const Rule& r = rules[pick(generator)];
+			for (int d = 0; d < NumDims; d++) {
+				p[d] = uniform_int_distribution<Point>(r.range[d].low, r.range[d].high)(generator);
+			}
+		} else {
+			for (int d = 0; d < NumDims; d++) {
+				p[d] = word(generator);
+			}
+			p[FieldSP] &= 0xFFFF;
+			p[FieldDP] &= 0xFFFF;
+			p[FieldProto] &= 0xFF;
+		}
+	}
+	return points;
+}
+
+void WriteAddress(FILE* out, const Interval& range, unsigned int length) {
+	fprintf(out, "%u.%u.%u.%u/%u", range.low >> 24, (range.low >> 16) & 0xFF, (range.low >> 8) & 0xFF, range.low & 0xFF, length);
+}
+
+void WriteRules(const string& filename, const vector<Rule>& rules) {
+	FILE* out = fopen(filename.c_str(), "w");
+	for (const Rule& r : rules) {
+		fprintf(out, "@");
+		WriteAddress(out, r.range[FieldSA], r.prefix_length[FieldSA]);
+		fprintf(out, "\t");
+		WriteAddress(out, r.range[FieldDA], r.prefix_length[FieldDA]);
+		fprintf(out, "\t%u : %u\t%u : %u\t", r.range[FieldSP].low, r.range[FieldSP].high, r.range[FieldDP].low, r.range[FieldDP].high);
+		if (r.range[FieldProto].low == r.range[FieldProto].high) {
+			fprintf(out, "0x%02X/0xFF\n", r.range[FieldProto].low);
+		} else {
+			fprintf(out, "0x00/0x00\n");
+		}
+	}
+	fclose(out);
+}
+
+void WritePackets(const string& filename, const vector<Point>& points) {
+	FILE* out = fopen(filename.c_str(), "w");
+	for (size_t i = 0; i < points.size(); i += NumDims) {
+		for (int d = 0; d < NumDims; d++) {
+			fprintf(out, "%u\t", points[i + d]);
+		}
+		fprintf(out, "0\t0\n");
+	}
+	fclose(out);
+}
+
+int main(int argc, char* argv[]) {
+	unordered_map<string, string> args = ParseArgs(argc, argv);
+
+	unsigned int seed = GetUIntOrElse(args, "Seed", 1);
+	size_t numRules = max(256u, GetUIntOrElse(args, "NumRules", 4096));
+	size_t numPackets = max(1u, GetUIntOrElse(args, "NumPackets", 4096));
+	string statsFile = GetOrElse(args, "Stats", "");
+	string tempDir = GetOrElse(args, "TempDir", "/tmp");
+	MicroBench bench(max(2u, GetUIntOrElse(args, "Samples", 15)), GetOrElse(args, "Kernels", ""));
+
+	mt19937 generator(seed);
+	vector<Rule> rules = GenerateRules(numRules, generator);
+	vector<Point> points = GeneratePackets(rules, numPackets, generator);
+	vector<Packet> packets;
+	for (size_t i = 0; i < numPackets; i++) {
+		packets.push_back(points.data() + i * NumDims);
+	}
+	printf("Seed %u: %lu rules, %lu packets\n", seed, numRules, numPackets);
+
+	{
+		size_t n = 256;
+		size_t rounds = max<size_t>(1, OpsPerSample / (n * numPackets));
+		bench.Time("MatchesPacket", n, rounds * n * numPackets, [&]() {
+			size_t matches = 0;
+			for (size_t k = 0; k < rounds; k++) {
+				for (Packet p : packets) {
+					for (size_t i = 0; i < n; i++) {
+						matches += rules[i].MatchesPacket(p);
+					}
+				}
+			}
+			return matches;
+		});
+	}
+
+	{
+		// Every cut width, at the top, middle and bottom of the field, for the fields that are cut
+		vector<tuple<uint8_t, uint8_t, uint8_t>> windows;
+		for (uint8_t dim : {FieldSA, FieldDA, FieldProto}) {
+			for (uint8_t delta = BitsPerNybble; delta <= MaxDelta; delta += BitsPerNybble) {
+				for (uint8_t nl : {0, 8, 16}) {
+					windows.push_back(make_tuple(dim, nl, BitsPerField - nl - delta));
+				}
+			}
+		}
+		size_t rounds = max<size_t>(1, OpsPerSample / (windows.size() * numRules));
+		bench.Time("GetSpan", numRules, rounds * windows.size() * numRules, [&]() {
+			size_t total = 0;
+			for (size_t k = 0; k < rounds; k++) {
+				for (auto& w : windows) {
+					for (const Rule& r : rules) {
+						SpanRange span = GetSpan(r, get<0>(w), get<1>(w), get<2>(w));
+						total += span.second - span.first;
+					}
+				}
+			}
+			return total;
+		});
+	}
+
+	for (uint8_t delta = BitsPerNybble; delta <= MaxDelta; delta += BitsPerNybble) {
+		ByteCutsNode* leaf = new ByteCutsNode();
+		ByteCutsNode::LeafNode(*leaf, vector<Rule>());
+		size_t numChildren = 0x1u << delta;
+		ByteCutsNode** children = new ByteCutsNode*[numChildren];
+		fill(children, children + numChildren, leaf);
+		ByteCutsNode node;
+		ByteCutsNode::CutNode(node, FieldDA, 8, BitsPerField - 8 - delta, children, false);
+
+		size_t rounds = max<size_t>(1, OpsPerSample / numPackets);
+		bench.Time("IndexPacket", delta, rounds * numPackets, [&]() {
+			size_t total = 0;
+			for (size_t k = 0; k < rounds; k++) {
+				for (Packet p : packets) {
+					total += node.IndexPacket(p);
+				}
+			}
+			return total;
+		});
+	}
+
+	// Leaves hold a priority-ordered sample of the rules; most packets scan the whole leaf
+	for (size_t n : {1, 2, 4, 8, 16, 32, 64, 128, 255}) {
+		vector<Rule> sample = rules;
+		shuffle(sample.begin(), sample.end(), generator);
+		sample.resize(n);
+		SortRules(sample);
+		ByteCutsNode leaf;
+		ByteCutsNode::LeafNode(leaf, sample);
+
+		size_t rounds = max<size_t>(1, OpsPerSample / (n * numPackets));
+		bench.Time("LeafScan", n, rounds * numPackets, [&]() {
+			size_t total = 0;
+			for (size_t k = 0; k < rounds; k++) {
+				for (Packet p : packets) {
+					total += leaf.ClassifyAPacket(p);
+				}
+			}
+			return total;
+		});
+	}
+
+	for (size_t n : {64, 256, 1024, 4096}) {
+		if (n > numRules) break;
+		vector<RuleIndex> indices(numRules);
+		iota(indices.begin(), indices.end(), 0);
+		shuffle(indices.begin(), indices.end(), generator);
+		indices.resize(n);
+		sort(indices.begin(), indices.end());
+		RuleSpan span(indices.data(), n);
+		TreeBuilder builder(rules, 8);
+
+		size_t calls = max<size_t>(1, 4096 / n);
+		bench.Time("BestSpan", n, calls, [&]() {
+			size_t total = 0;
+			for (size_t k = 0; k < calls; k++) {
+				total += get<3>(builder.BestSpan(span, LimitedSplit, 5));
+			}
+			return total;
+		});
+		bench.Time("BestSplit", n, calls, [&]() {
+			size_t total = 0;
+			for (size_t k = 0; k < calls; k++) {
+				total += get<2>(builder.BestSplit(span));
+			}
+			return total;
+		});
+	}
+
+	// The parsers read files written from the same rules and packets, timed per line
+	string base = tempDir + "/microbench." + to_string(getpid());
+	string rulesFile = base + ".rules";
+	string packetFile = base + ".trace";
+	WriteRules(rulesFile, rules);
+	WritePackets(packetFile, points);
+	bench.Time("ReadFilterFile", numRules, numRules, [&]() {
+		return InputReader::ReadFilterFile(rulesFile).size();
+	});
+	bench.Time("ReadPackets", numPackets, numPackets, [&]() {
+		vector<Packet> read = InputReader::ReadPackets(packetFile);
+		for (Packet p : read) {
+			delete [] p;
+		}
+		return read.size();
+	});
+	remove(rulesFile.c_str());
+	remove(packetFile.c_str());
+
+	if (!statsFile.empty()) {
+		OutputWriter::WriteCsvFile(statsFile, bench.Header(), bench.Rows());
+	}
+	return 0;
+}
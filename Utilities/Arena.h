@@ -0,0 +1,114 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// A contiguous run of elements that the owner does not free
+template <class T>
+struct ScratchSpan {
+	T* first = nullptr;
+	size_t count = 0;
+
+	ScratchSpan() {}
+	ScratchSpan(T* first, size_t count) : first(first), count(count) {}
+
+	T* begin() const { return first; }
+	T* end() const { return first + count; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T& operator[](size_t i) const { return first[i]; }
+};
+
+// Monotonic bump allocator for build temporaries
+// Memory is only reclaimed by rewinding to an earlier Position() or by Reset(),
+// so scratch data must be released in the reverse order it was taken
+class ScratchArena {
+public:
+	struct Mark {
+		size_t block;
+		size_t offset;
+	};
+
+	explicit ScratchArena(size_t blockSize = 1 << 20) : blockSize(blockSize) {}
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	template <class T>
+	T* Allocate(size_t n) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena memory is never destroyed");
+		return static_cast<T*>(AllocateBytes(n * sizeof(T), alignof(T)));
+	}
+
+	Mark Position() const { return Mark{current, offset}; }
+	void Release(Mark mark) {
+		current = mark.block;
+		offset = mark.offset;
+	}
+	void Reset() {
+		current = 0;
+		offset = 0;
+	}
+
+	size_t Capacity() const {
+		size_t total = 0;
+		for (const Block& b : blocks) total += b.size;
+		return total;
+	}
+private:
+	struct Block {
+		std::unique_ptr<char[]> data;
+		size_t size;
+		explicit Block(size_t size) : data(new char[size]), size(size) {}
+	};
+
+	void* AllocateBytes(size_t bytes, size_t align) {
+		if (current < blocks.size()) {
+			size_t start = (offset + align - 1) & ~(align - 1);
+			if (start + bytes <= blocks[current].size) {
+				offset = start + bytes;
+				return blocks[current].data.get() + start;
+			}
+			current++;
+		}
+		// Blocks past the current one are free: reuse the next if it fits, else slot in a new one
+		if (current >= blocks.size() || blocks[current].size < bytes) {
+			blocks.insert(blocks.begin() + current, Block(std::max(blockSize, bytes)));
+		}
+		offset = bytes;
+		return blocks[current].data.get();
+	}
+
+	std::vector<Block> blocks;
+	size_t blockSize;
+	size_t current = 0;
+	size_t offset = 0;
+};
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "BuildProfiler.h"
+#include "MemoryUsage.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+static thread_local BuildProfiler* installed = nullptr;
+
+BuildProfiler::BuildProfiler() {
+	Phase root;
+	root.name = "";
+	root.parent = 0;
+	phases.push_back(root);
+}
+
+BuildProfiler* BuildProfiler::Current() {
+	return installed;
+}
+
+void BuildProfiler::Install(BuildProfiler* profiler) {
+	installed = profiler;
+}
+
+void BuildProfiler::Enter(const char* name, size_t rules) {
+	size_t found = 0;
+	for (size_t c : phases[current].children) {
+		if (phases[c].name == name || strcmp(phases[c].name, name) == 0) {
+			found = c;
+			break;
+		}
+	}
+	if (found == 0) {
+		found = phases.size();
+		Phase phase;
+		phase.name = name;
+		phase.parent = current;
+		phases.push_back(phase);
+		phases[current].children.push_back(found);
+	}
+	current = found;
+	phases[current].calls++;
+	phases[current].rules += rules;
+}
+
+void BuildProfiler::Exit(uint64_t nanoseconds) {
+	Phase& phase = phases[current];
+	phase.nanoseconds += nanoseconds;
+	current = phase.parent;
+}
+
+void BuildProfiler::AddRssGrowth(int64_t bytes) {
+	phases[current].sampledRss = true;
+	phases[current].rssGrowth += bytes;
+}
+
+Memory BuildProfiler::ResidentBytes() {
+	return CurrentRssBytes();
+}
+
+void BuildProfiler::AddComposer(size_t entries) {
+	phases[current].composer += entries;
+}
+
+string BuildProfiler::PathOf(size_t phase, char separator) const {
+	string path = phases[phase].name;
+	for (size_t p = phases[phase].parent; p != 0; p = phases[p].parent) {
+		path = phases[p].name + (separator + path);
+	}
+	return path;
+}
+
+uint64_t BuildProfiler::SelfNanoseconds(size_t phase) const {
+	uint64_t self = phases[phase].nanoseconds;
+	for (size_t c : phases[phase].children) {
+		self -= min(self, phases[c].nanoseconds);
+	}
+	return self;
+}
+
+bool BuildProfiler::WriteCsv(const string& filename) const {
+	ofstream out(filename);
+	if (!out.is_open()) {
+		printf("Couldnt open profile file %s\n", filename.c_str());
+		return false;
+	}
+	out << "Phase,Calls,TotalMs,SelfMs,Rules,Composer,RssGrowth" << endl;
+	for (size_t p = 1; p < phases.size(); p++) {
+		const Phase& phase = phases[p];
+		out << PathOf(p, '/') << "," << phase.calls << "," << phase.nanoseconds / 1e6 << "," << SelfNanoseconds(p) / 1e6 << "," << phase.rules << "," << phase.composer << ",";
+		// Phases that never sampled the resident set leave the column empty rather than claim no growth
+		if (phase.sampledRss) {
+			out << phase.rssGrowth;
+		}
+		out << endl;
+	}
+	return true;
+}
+
+bool BuildProfiler::WriteFolded(const string& filename) const {
+	ofstream out(filename);
+	if (!out.is_open()) {
+		printf("Couldnt open profile file %s\n", filename.c_str());
+		return false;
+	}
+	for (size_t p = 1; p < phases.size(); p++) {
+		uint64_t micros = SelfNanoseconds(p) / 1000;
+		if (micros > 0) {
+			out << PathOf(p, ';') << " " << micros << endl;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,110 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef BUILD_PROFILER_H
+#define BUILD_PROFILER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../Common.h"
+
+// Whether a scope samples the resident set on entry and exit
+// Each sample reads /proc, so only classifier-level phases take them, never per-node ones
+enum RssSampling { NoRss, SampleRss };
+
+// Hierarchical timers and counters for classifier construction
+// A profiler installed on a thread collects every ProfileScope opened on that thread into a tree of
+// phases keyed by their call path. With no profiler installed a scope costs one thread-local load
+class BuildProfiler {
+public:
+	BuildProfiler();
+
+	// The profiler collecting on the calling thread, or null
+	static BuildProfiler* Current();
+	static void Install(BuildProfiler* profiler);
+
+	void Enter(const char* name, size_t rules);
+	void Exit(uint64_t nanoseconds);
+	// Resident set growth from entry to exit of the current phase's call, negative when it freed memory
+	void AddRssGrowth(int64_t bytes);
+	static Memory ResidentBytes();
+	// Distinct child rule sets found by the composer of the current cut node
+	void AddComposer(size_t entries);
+
+	// One row per call path: calls, cumulative and self time, rules processed, composer entries, RSS growth
+	bool WriteCsv(const std::string& filename) const;
+	// "Outer;Inner self-microseconds" lines, as read by flamegraph.pl
+	bool WriteFolded(const std::string& filename) const;
+private:
+	struct Phase {
+		const char* name;
+		size_t parent;
+		std::vector<size_t> children;
+		size_t calls = 0;
+		uint64_t nanoseconds = 0;
+		size_t rules = 0;
+		size_t composer = 0;
+		bool sampledRss = false;
+		int64_t rssGrowth = 0;
+	};
+
+	std::string PathOf(size_t phase, char separator) const;
+	uint64_t SelfNanoseconds(size_t phase) const;
+
+	std::vector<Phase> phases;
+	size_t current = 0;
+};
+
+// Times the enclosing block as a phase of the current profiler, if one is installed
+class ProfileScope {
+public:
+	explicit ProfileScope(const char* name, size_t rules = 0, RssSampling rss = NoRss) : profiler(BuildProfiler::Current()), sampleRss(rss == SampleRss) {
+		if (profiler) {
+			profiler->Enter(name, rules);
+			if (sampleRss) entryRss = BuildProfiler::ResidentBytes();
+			start = std::chrono::steady_clock::now();
+		}
+	}
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+	~ProfileScope() {
+		if (profiler) {
+			std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+			if (sampleRss) profiler->AddRssGrowth(int64_t(BuildProfiler::ResidentBytes()) - int64_t(entryRss));
+			profiler->Exit(elapsed.count());
+		}
+	}
+
+	void AddComposer(size_t entries) {
+		if (profiler) profiler->AddComposer(entries);
+	}
+private:
+	BuildProfiler* profiler;
+	bool sampleRss;
+	Memory entryRss = 0;
+	std::chrono::steady_clock::time_point start;
+};
+
+#endif
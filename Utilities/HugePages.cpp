@@ -0,0 +1,145 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "HugePages.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sys/mman.h>
+
+using namespace std;
+
+HugePageArena::HugePageArena(const string& policy, size_t chunkSize) : chunkSize(chunkSize) {
+	if (policy == "Auto") {
+		tryHugeTlb = true;
+	} else if (policy == "Transparent") {
+		tryHugeTlb = false;
+	} else {
+		printf("Unknown HugePages policy: %s\n", policy.c_str());
+		exit(EXIT_FAILURE);
+	}
+}
+
+HugePageArena::~HugePageArena() {
+	for (const Chunk& c : chunks) {
+		munmap(c.data, c.size);
+	}
+}
+
+void* HugePageArena::AllocateBytes(size_t bytes, size_t align) {
+	if (!chunks.empty()) {
+		size_t start = (offset + align - 1) & ~(align - 1);
+		if (start + bytes <= chunks.back().size) {
+			offset = start + bytes;
+			return chunks.back().data + start;
+		}
+	}
+	MapChunk(bytes);
+	offset = bytes;
+	return chunks.back().data;
+}
+
+void HugePageArena::MapChunk(size_t bytes) {
+	size_t size = (max(bytes, chunkSize) + HugePageSize - 1) / HugePageSize * HugePageSize;
+	
+#ifdef MAP_HUGETLB
+	if (tryHugeTlb) {
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			chunks.push_back(Chunk{static_cast<char*>(p), size, true});
+			return;
+		}
+		// The huge page pool is empty or unconfigured
+		tryHugeTlb = false;
+	}
+#endif
+	
+	// Over-map so that the chunk can start on a huge page boundary
+	void* p = mmap(nullptr, size + HugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		throw bad_alloc();
+	}
+	char* raw = static_cast<char*>(p);
+	char* aligned = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(raw) + HugePageSize - 1) & ~(uintptr_t)(HugePageSize - 1));
+	if (aligned > raw) {
+		munmap(raw, aligned - raw);
+	}
+	munmap(aligned + size, raw + HugePageSize - aligned);
+#ifdef MADV_HUGEPAGE
+	madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+	chunks.push_back(Chunk{aligned, size, false});
+}
+
+size_t HugePageArena::MappedBytes() const {
+	size_t total = 0;
+	for (const Chunk& c : chunks) {
+		total += c.size;
+	}
+	return total;
+}
+
+size_t HugePageArena::TransparentHugeBytes() const {
+	// AnonHugePages of every mapping in /proc/self/smaps that lies inside one of our chunks
+	ifstream smaps("/proc/self/smaps");
+	string line;
+	bool inside = false;
+	size_t total = 0;
+	while (getline(smaps, line)) {
+		uintptr_t start, end;
+		if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+			inside = false;
+			for (const Chunk& c : chunks) {
+				uintptr_t base = reinterpret_cast<uintptr_t>(c.data);
+				if (!c.hugetlb && start < base + c.size && base < end) {
+					inside = true;
+				}
+			}
+		} else if (inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+			size_t kib = 0;
+			sscanf(line.c_str() + 14, "%lu", &kib);
+			total += kib * 1024;
+		}
+	}
+	return total;
+}
+
+string HugePageArena::Backing() const {
+	if (chunks.empty()) return "none";
+	
+	size_t hugetlbBytes = 0, otherBytes = 0;
+	for (const Chunk& c : chunks) {
+		(c.hugetlb ? hugetlbBytes : otherBytes) += c.size;
+	}
+	string other;
+	if (otherBytes > 0) {
+		// Transparent huge pages are only granted as the memory is touched, and may be refused
+		other = TransparentHugeBytes() > 0 ? "thp" : "4k";
+	}
+	if (hugetlbBytes == 0) return other;
+	if (otherBytes == 0) return "hugetlb";
+	return "hugetlb+" + other;
+}
@@ -0,0 +1,68 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <string>
+#include <vector>
+
+// Bump allocator over anonymous mappings backed by 2 MiB pages where the system allows it
+// Policy "Auto" asks for MAP_HUGETLB pages and falls back to madvise(MADV_HUGEPAGE);
+// "Transparent" only uses madvise. Nothing is freed before the arena, so it suits frozen structures
+class HugePageArena {
+public:
+	static const size_t HugePageSize = 2 << 20;
+
+	explicit HugePageArena(const std::string& policy, size_t chunkSize = 2 * HugePageSize);
+	HugePageArena(const HugePageArena&) = delete;
+	HugePageArena& operator=(const HugePageArena&) = delete;
+	~HugePageArena();
+
+	void* AllocateBytes(size_t bytes, size_t align);
+	template <class T>
+	T* Allocate(size_t n) {
+		return static_cast<T*>(AllocateBytes(n * sizeof(T), alignof(T)));
+	}
+
+	size_t MappedBytes() const;
+	// Backing the kernel actually provided: "hugetlb", "thp", "4k", or "hugetlb+" the backing of chunks mapped after the pool ran out
+	std::string Backing() const;
+private:
+	struct Chunk {
+		char* data;
+		size_t size;
+		bool hugetlb;
+	};
+
+	void MapChunk(size_t bytes);
+	size_t TransparentHugeBytes() const;
+
+	bool tryHugeTlb;
+	size_t chunkSize;
+	std::vector<Chunk> chunks;
+	size_t offset = 0;
+};
+
+#endif
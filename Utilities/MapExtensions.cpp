@@ -74,6 +74,17 @@ double GetDoubleOrElse(const unordered_map<string, string> &m, const string& key
 	else return std::stod(m.at(key));
 }
 
+unsigned long long GetBytesOrElse(const unordered_map<string, string> &m, const string& key, unsigned long long def) {
+	if (m.find(key) == m.end()) return def;
+	size_t end;
+	unsigned long long bytes = std::stoull(m.at(key), &end);
+	string suffix = m.at(key).substr(end);
+	if (suffix == "K") return bytes << 10;
+	else if (suffix == "M") return bytes << 20;
+	else if (suffix == "G") return bytes << 30;
+	return bytes;
+}
+
 void Split(const string &s, char delim, vector<string>& tokens) {
 	stringstream ss(s);
 	string item;
@@ -48,6 +48,8 @@ bool GetBoolOrElse(const std::unordered_map<std::string, std::string> &m, const
 int GetIntOrElse(const std::unordered_map<std::string, std::string> &m, const std::string& key, int def);
 unsigned int GetUIntOrElse(const std::unordered_map<std::string, std::string> &m, const std::string& key, unsigned int def);
 double GetDoubleOrElse(const std::unordered_map<std::string, std::string> &m, const std::string& key, double def);
+// A byte count, optionally suffixed K, M or G for binary multiples
+unsigned long long GetBytesOrElse(const std::unordered_map<std::string, std::string> &m, const std::string& key, unsigned long long def);
 
 void Split(const std::string &s, char delim, std::vector<std::string>& tokens);
 
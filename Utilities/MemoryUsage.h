@@ -0,0 +1,65 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include "../Common.h"
+
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Resident set size of this process right now
+inline Memory CurrentRssBytes() {
+	std::ifstream statm("/proc/self/statm");
+	size_t size, resident;
+	if (!(statm >> size >> resident)) return 0;
+	return static_cast<Memory>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// High-water mark of the resident set size of this process, since the last ResetPeakRss
+inline Memory PeakRssBytes() {
+	std::ifstream status("/proc/self/status");
+	std::string key;
+	Memory kib;
+	while (status >> key) {
+		if (key == "VmHWM:" && status >> kib) return kib * 1024;
+	}
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	// ru_maxrss is reported in KiB on Linux
+	return static_cast<Memory>(usage.ru_maxrss) * 1024;
+}
+
+// Restarts the high-water mark from the current resident set size; false where the kernel does not allow it
+inline bool ResetPeakRss() {
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	if (!clearRefs) return false;
+	clearRefs << "5" << std::flush;
+	return clearRefs.good();
+}
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "Redundancy.h"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+
+struct Box {
+	Interval range[NumDims];
+};
+
+static bool Contains(const Rule& outer, const Rule& inner) {
+	for (int d = 0; d < NumDims; d++) {
+		if (outer.range[d].low > inner.range[d].low || outer.range[d].high < inner.range[d].high) return false;
+	}
+	return true;
+}
+
+static bool Intersects(const Box& b, const Rule& r) {
+	for (int d = 0; d < NumDims; d++) {
+		if (b.range[d].high < r.range[d].low || b.range[d].low > r.range[d].high) return false;
+	}
+	return true;
+}
+
+// Replaces b by the disjoint boxes that make up b minus r, peeling off one slab per side per dimension
+static void Subtract(Box b, const Rule& r, vector<Box>& out) {
+	for (int d = 0; d < NumDims; d++) {
+		if (b.range[d].low < r.range[d].low) {
+			Box below = b;
+			below.range[d].high = r.range[d].low - 1;
+			out.push_back(below);
+			b.range[d].low = r.range[d].low;
+		}
+		if (b.range[d].high > r.range[d].high) {
+			Box above = b;
+			above.range[d].low = r.range[d].high + 1;
+			out.push_back(above);
+			b.range[d].high = r.range[d].high;
+		}
+	}
+}
+
+// Whether the union of the cover rules contains r; undecided is set when the pieces exceed maxPieces
+static bool CoveredByUnion(const Rule& r, const vector<const Rule*>& cover, size_t maxPieces, bool& undecided) {
+	vector<Box> pieces(1), next;
+	copy_n(r.range, NumDims, pieces[0].range);
+	for (const Rule* c : cover) {
+		next.clear();
+		for (const Box& b : pieces) {
+			if (Intersects(b, *c)) {
+				Subtract(b, *c, next);
+			} else {
+				next.push_back(b);
+			}
+		}
+		pieces.swap(next);
+		if (pieces.empty()) return true;
+		if (pieces.size() > maxPieces) {
+			undecided = true;
+			return false;
+		}
+	}
+	return false;
+}
+
+RedundancyReport RemoveRedundantRules(vector<Rule>& rules, size_t maxPieces) {
+	RedundancyReport report;
+	vector<size_t> order(rules.size());
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return rules[x].priority > rules[y].priority; });
+	
+	vector<bool> dead(rules.size(), false);
+	vector<const Rule*> kept;
+	vector<const Rule*> cover;
+	for (size_t i = 0; i < order.size(); ) {
+		// Rules of equal priority do not cover one another, so each group is tested before any is kept
+		size_t groupEnd = i;
+		while (groupEnd < order.size() && rules[order[groupEnd]].priority == rules[order[i]].priority) {
+			groupEnd++;
+		}
+		for (size_t j = i; j < groupEnd; j++) {
+			const Rule& r = rules[order[j]];
+			cover.clear();
+			bool single = false;
+			for (const Rule* k : kept) {
+				if (!k->IntersectsRule(r)) continue;
+				if (Contains(*k, r)) {
+					single = true;
+					break;
+				}
+				cover.push_back(k);
+			}
+			bool undecided = false;
+			if (single) {
+				report.coveredBySingle++;
+				dead[order[j]] = true;
+			} else if (cover.size() > 1 && CoveredByUnion(r, cover, maxPieces, undecided)) {
+				report.coveredByUnion++;
+				dead[order[j]] = true;
+			}
+			if (undecided) {
+				report.undecided++;
+			}
+		}
+		for (size_t j = i; j < groupEnd; j++) {
+			if (!dead[order[j]]) {
+				kept.push_back(&rules[order[j]]);
+			}
+		}
+		i = groupEnd;
+	}
+	
+	size_t n = 0;
+	for (size_t i = 0; i < rules.size(); i++) {
+		if (!dead[i]) {
+			rules[n++] = rules[i];
+		}
+	}
+	rules.resize(n);
+	return report;
+}
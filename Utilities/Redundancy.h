@@ -0,0 +1,49 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef REDUNDANCY_H
+#define REDUNDANCY_H
+
+#include <vector>
+#include "../Common.h"
+
+struct RedundancyReport {
+	// Rules inside a single higher-priority rule
+	size_t coveredBySingle = 0;
+	// Rules covered only by the union of several higher-priority rules
+	size_t coveredByUnion = 0;
+	// Rules kept because their uncovered part broke into more than maxPieces boxes
+	size_t undecided = 0;
+
+	size_t Removed() const {
+		return coveredBySingle + coveredByUnion;
+	}
+};
+
+// Removes the rules no packet can match, because higher-priority rules cover them, and keeps the rest in order
+// Each rule's box has every intersecting kept rule of higher priority subtracted from it; it is dead
+// once nothing is left. Removed rules never need to be subtracted, since the rules that cover them remain
+RedundancyReport RemoveRedundantRules(std::vector<Rule>& rules, size_t maxPieces = 256);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2017 by J. Daly at Michigan State University
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread
+// Each side keeps a private copy of the other's index and rereads the shared one only when
+// the copy says the ring is full or empty, so the shared cache lines move rarely
+template <class T>
+class SpscRing {
+public:
+	// Capacity is rounded up to a power of two
+	explicit SpscRing(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) size <<= 1;
+		slots.reset(new T[size]);
+		mask = size - 1;
+	}
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	bool TryPush(const T& item) {
+		size_t t = producer.index.load(std::memory_order_relaxed);
+		if (t - producer.cached > mask) {
+			producer.cached = consumer.index.load(std::memory_order_acquire);
+			if (t - producer.cached > mask) return false;
+		}
+		slots[t & mask] = item;
+		producer.index.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	bool TryPop(T& item) {
+		size_t h = consumer.index.load(std::memory_order_relaxed);
+		if (h == consumer.cached) {
+			consumer.cached = producer.index.load(std::memory_order_acquire);
+			if (h == consumer.cached) return false;
+		}
+		item = slots[h & mask];
+		consumer.index.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Blocking forms: spin briefly, then give up the core so that oversubscribed runs still progress
+	void Push(const T& item) {
+		for (size_t spins = 0; !TryPush(item); spins++) {
+			if (spins >= 64) std::this_thread::yield();
+		}
+	}
+	T Pop() {
+		T item;
+		for (size_t spins = 0; !TryPop(item); spins++) {
+			if (spins >= 64) std::this_thread::yield();
+		}
+		return item;
+	}
+private:
+	// Padded so that the producer's and consumer's indices sit on separate cache lines
+	struct Side {
+		std::atomic<size_t> index{0};
+		// The other side's index as last seen
+		size_t cached = 0;
+		char padding[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+	};
+
+	Side producer;
+	Side consumer;
+	std::unique_ptr<T[]> slots;
+	size_t mask;
+};
+
+#endif
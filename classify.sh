@@ -19,5 +19,8 @@ BC=${OutputDir}/Results/BC_${RuleList}.txt
 
 ${Program} Rules=${File} Packets=${Packets} Stats=${Output} BC.TurningPoint=0.01 BC.BadFraction=0.02 Results=${BC} 
 
+# Search the BC.* parameters for this policy instead; the Pareto-best rows are marked in the stats file
+#${Program} Rules=${File} Packets=${Packets} Stats=${OutputDir}/${RuleList}.tune.csv Tune=32
+
 #${Validate} Rules=${File} Packets=${Packets} ByteCuts=${BC} SmartSplit=${SS}
 